@@ -0,0 +1,127 @@
+#include "AccelerationStructure.h"
+
+namespace dae {
+	void AccelerationStructure::Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices)
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::BVH:
+			m_BVH.Build(minBounds, maxBounds, triangleVertices);
+			break;
+		case AccelerationType::Grid:
+			m_Grid.Build(minBounds, maxBounds);
+			break;
+		case AccelerationType::KdTree:
+			m_KdTree.Build(minBounds, maxBounds);
+			break;
+		}
+	}
+
+	void AccelerationStructure::Update(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices)
+	{
+		if (m_Type == AccelerationType::BVH)
+		{
+			m_BVH.Update(minBounds, maxBounds, triangleVertices);
+			return;
+		}
+
+		Build(minBounds, maxBounds, triangleVertices);
+	}
+
+	void AccelerationStructure::Clear()
+	{
+		m_BVH.Clear();
+		m_Grid.Clear();
+		m_KdTree.Clear();
+	}
+
+	void AccelerationStructure::SetType(AccelerationType type)
+	{
+		if (type == m_Type)
+		{
+			return;
+		}
+
+		Clear();
+		m_Type = type;
+	}
+
+	const char* AccelerationStructure::GetTypeName(AccelerationType type)
+	{
+		switch (type)
+		{
+		case AccelerationType::BVH:
+			return "BVH";
+		case AccelerationType::Grid:
+			return "GRID";
+		case AccelerationType::KdTree:
+			return "KD-TREE";
+		}
+		return "";
+	}
+
+	bool AccelerationStructure::IsEmpty() const
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::Grid:
+			return m_Grid.IsEmpty();
+		case AccelerationType::KdTree:
+			return m_KdTree.IsEmpty();
+		default:
+			return m_BVH.IsEmpty();
+		}
+	}
+
+	uint32_t AccelerationStructure::GetPrimitiveCount() const
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::Grid:
+			return m_Grid.GetPrimitiveCount();
+		case AccelerationType::KdTree:
+			return m_KdTree.GetPrimitiveCount();
+		default:
+			return m_BVH.GetPrimitiveCount();
+		}
+	}
+
+	float AccelerationStructure::GetBuildTime() const
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::Grid:
+			return m_Grid.GetBuildTime();
+		case AccelerationType::KdTree:
+			return m_KdTree.GetBuildTime();
+		default:
+			return m_BVH.GetBuildStats().buildTime;
+		}
+	}
+
+	Vector3 AccelerationStructure::GetMinAABB() const
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::Grid:
+			return m_Grid.GetMinAABB();
+		case AccelerationType::KdTree:
+			return m_KdTree.GetMinAABB();
+		default:
+			return m_BVH.GetNodes()[0].minAABB;
+		}
+	}
+
+	Vector3 AccelerationStructure::GetMaxAABB() const
+	{
+		switch (m_Type)
+		{
+		case AccelerationType::Grid:
+			return m_Grid.GetMaxAABB();
+		case AccelerationType::KdTree:
+			return m_KdTree.GetMaxAABB();
+		default:
+			return m_BVH.GetNodes()[0].maxAABB;
+		}
+	}
+}
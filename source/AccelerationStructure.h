@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+#include "Grid.h"
+#include "KdTree.h"
+
+namespace dae
+{
+	enum class AccelerationType
+	{
+		BVH,	//Best all-rounder, refits cheaply when primitives move
+		Grid,	//Uniform grid, fastest to build, good for dense and evenly spread primitives
+		KdTree	//SAH kd-tree, tight fit around sparse geometry, slowest to build
+	};
+
+	//Common front for the acceleration structures, only the structure of the selected type is built
+	//Traversal dispatches on the type as well, see GeometryUtils::HitTest_AccelerationStructure
+	class AccelerationStructure final
+	{
+	public:
+		/**
+		 * \brief Builds the structure of the current type
+		 * \param minBounds min corner of the AABB of every primitive
+		 * \param maxBounds max corner of the AABB of every primitive
+		 * \param triangleVertices 3 vertices per primitive, only used by the spatial split BVH builder
+		 */
+		void Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices = {});
+
+		//The BVH refits when it can, grids and kd-trees always rebuild
+		void Update(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices = {});
+		void Clear();
+
+		//Switching type clears the structure, it gets built again on the next Build or Update
+		void SetType(AccelerationType type);
+		AccelerationType GetType() const { return m_Type; }
+		static const char* GetTypeName(AccelerationType type);
+
+		bool IsEmpty() const;
+		uint32_t GetPrimitiveCount() const;
+		float GetBuildTime() const;
+
+		//Bounds around every primitive, only valid when not empty
+		Vector3 GetMinAABB() const;
+		Vector3 GetMaxAABB() const;
+
+		//BVH settings (builder, layout) are set straight on the BVH
+		BVH& GetBVH() { return m_BVH; }
+		const BVH& GetBVH() const { return m_BVH; }
+		const Grid& GetGrid() const { return m_Grid; }
+		const KdTree& GetKdTree() const { return m_KdTree; }
+
+	private:
+		AccelerationType m_Type{ AccelerationType::BVH };
+
+		BVH m_BVH{};
+		Grid m_Grid{};
+		KdTree m_KdTree{};
+	};
+}
@@ -0,0 +1,1484 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <thread>
+
+namespace dae {
+	//Index of the last primitive of the left half, where the highest differing Morton bit flips
+	static uint32_t FindSplit(const std::vector<uint64_t>& mortonCodes, uint32_t first, uint32_t last)
+	{
+		const uint64_t firstCode = mortonCodes[first];
+		const uint64_t lastCode = mortonCodes[last];
+
+		//Identical codes, just halve the range
+		if (firstCode == lastCode)
+		{
+			return (first + last) / 2;
+		}
+
+		const int commonPrefix = std::countl_zero(firstCode ^ lastCode);
+
+		//Binary search for the last code that still shares more than commonPrefix bits with the first one
+		uint32_t split = first;
+		uint32_t step = last - first;
+		do
+		{
+			step = (step + 1) / 2;
+			const uint32_t newSplit = split + step;
+
+			if (newSplit < last && std::countl_zero(firstCode ^ mortonCodes[newSplit]) > commonPrefix)
+			{
+				split = newSplit;
+			}
+		} while (step > 1);
+
+		return split;
+	}
+
+	/**
+	 * \brief Orders a tree depth-first, cut into treelets: a treelet grows from its root by the child with the highest
+	 * visit probability until it fills the rest of its treeletSize block, the children that didn't fit start the next treelets
+	 * \param nodeCount upper bound of the node indices, the root is node 0
+	 * \param getChildren appends the inner children of a node to a vector
+	 * \param getProbability (relative) probability that a ray visits a node
+	 * \return the node indices in their new order
+	 */
+	template<typename GetChildren, typename GetProbability>
+	static std::vector<uint32_t> TreeletOrder(size_t nodeCount, size_t treeletSize, GetChildren&& getChildren, GetProbability&& getProbability)
+	{
+		std::vector<uint32_t> order{};
+		order.reserve(nodeCount);
+
+		std::vector<bool> inTreelet(nodeCount, false);
+		std::vector<uint32_t> treeletRoots{ 0 };
+		std::vector<std::pair<float, uint32_t>> candidates{};
+		std::vector<uint32_t> stack{};
+		std::vector<uint32_t> children{};
+
+		//Treelet roots are handled in the order they got cut off, so the treelets near the root come first
+		for (size_t rootIndex = 0; rootIndex < treeletRoots.size(); ++rootIndex)
+		{
+			const uint32_t root = treeletRoots[rootIndex];
+
+			//Treelets never cross a block, small subtrees share one
+			const size_t capacity = treeletSize - order.size() % treeletSize;
+
+			candidates.clear();
+			candidates.push_back({ getProbability(root), root });
+			for (size_t memberCount = 0; memberCount < capacity && !candidates.empty(); ++memberCount)
+			{
+				std::pop_heap(candidates.begin(), candidates.end());
+				const uint32_t node = candidates.back().second;
+				candidates.pop_back();
+
+				inTreelet[node] = true;
+
+				children.clear();
+				getChildren(node, children);
+				for (const uint32_t child : children)
+				{
+					candidates.push_back({ getProbability(child), child });
+					std::push_heap(candidates.begin(), candidates.end());
+				}
+			}
+
+			//Depth-first through the treelet, children outside of it become the roots of later treelets
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				const uint32_t node = stack.back();
+				stack.pop_back();
+				order.push_back(node);
+
+				children.clear();
+				getChildren(node, children);
+
+				//The most likely visited child goes right after its parent
+				std::sort(children.begin(), children.end(), [&](uint32_t a, uint32_t b) { return getProbability(a) < getProbability(b); });
+				for (const uint32_t child : children)
+				{
+					if (inTreelet[child])
+					{
+						stack.push_back(child);
+					}
+				}
+				for (const uint32_t child : children)
+				{
+					if (!inTreelet[child])
+					{
+						treeletRoots.push_back(child);
+					}
+				}
+			}
+		}
+
+		return order;
+	}
+
+	//Adds the cache lines and treelet blocks of [offset, offset + size) that the parent range doesn't cover
+	static void AddCacheMisses(size_t offset, size_t size, size_t parentOffset, size_t parentSize, float probability, BVHCacheStats& stats)
+	{
+		const size_t parentFirstLine = parentOffset / BVH::CacheLineSize;
+		const size_t parentLastLine = (parentOffset + parentSize - 1) / BVH::CacheLineSize;
+		for (size_t line = offset / BVH::CacheLineSize; line <= (offset + size - 1) / BVH::CacheLineSize; ++line)
+		{
+			if (line < parentFirstLine || line > parentLastLine)
+			{
+				stats.l1Misses += probability;
+			}
+		}
+
+		if (offset / BVH::TreeletSize != parentOffset / BVH::TreeletSize)
+		{
+			stats.l2Misses += probability;
+		}
+	}
+
+	void BVH::Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices)
+	{
+		assert(minBounds.size() == maxBounds.size());
+		assert(triangleVertices.empty() || triangleVertices.size() == minBounds.size() * 3);
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		Clear();
+
+		const uint32_t primitiveCount = static_cast<uint32_t>(minBounds.size());
+		if (primitiveCount == 0)
+		{
+			return;
+		}
+		m_PrimitiveCount = primitiveCount;
+
+		std::vector<Vector3> centroids{};
+		centroids.reserve(primitiveCount);
+		m_PrimitiveIndices.reserve(primitiveCount);
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			centroids.push_back((minBounds[index] + maxBounds[index]) * 0.5f);
+			m_PrimitiveIndices.push_back(index);
+		}
+
+		BVHNode root{};
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		UpdateNodeBounds(root, minBounds, maxBounds);
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes
+		switch (m_Builder)
+		{
+		case BVHBuilder::SweepSAH:
+			m_Nodes.reserve(primitiveCount * 2 - 1);
+			m_Nodes.push_back(root);
+
+			Subdivide(0, 1, minBounds, maxBounds, centroids);
+			break;
+		case BVHBuilder::BinnedSAH:
+		default:
+		{
+			//Workers write to disjoint nodes and primitive ranges, new nodes are claimed through nodesUsed
+			m_Nodes.resize(primitiveCount * 2 - 1);
+			m_Nodes[0] = root;
+			std::atomic<uint32_t> nodesUsed{ 1 };
+
+			//Spawn tasks for the top levels only, enough to keep every core busy
+			uint32_t parallelDepth{ 1 };
+			while ((1u << parallelDepth) < std::thread::hardware_concurrency() * 2)
+			{
+				++parallelDepth;
+			}
+
+			SubdivideBinned(0, 1, parallelDepth, minBounds, maxBounds, centroids, nodesUsed);
+			m_Nodes.resize(nodesUsed);
+			break;
+		}
+		case BVHBuilder::LBVH:
+			m_Nodes.reserve(primitiveCount * 2 - 1);
+			m_Nodes.push_back(root);
+
+			BuildLinear(minBounds, maxBounds, centroids);
+			break;
+		case BVHBuilder::SpatialSAH:
+		{
+			std::vector<Reference> references(primitiveCount);
+			for (uint32_t index = 0; index < primitiveCount; ++index)
+			{
+				references[index] = { minBounds[index], maxBounds[index], index };
+			}
+
+			//The leaves append their references while the tree gets built
+			m_PrimitiveIndices.clear();
+			m_PrimitiveIndices.reserve(primitiveCount);
+			m_Nodes.push_back(root);
+
+			const uint32_t splitBudget = static_cast<uint32_t>(primitiveCount * SpatialSplitBudget);
+			SubdivideSpatial(0, 1, references, triangleVertices, SurfaceArea(root.minAABB, root.maxAABB), splitBudget);
+			break;
+		}
+		}
+
+		SplitLargeLeaves(minBounds, maxBounds);
+
+		//Every builder emits its own node order, bring them all in the same cache friendly one
+		//The cache estimates of the traversed nodes are taken right before and after their treelet reorder
+		m_BuildStats.buildOrderCache = {};
+		m_BuildStats.treeletOrderCache = {};
+		if (m_Layout == BVHLayout::Binary)
+		{
+			m_BuildStats.buildOrderCache = EstimateCacheMisses();
+			ReorderNodes();
+			m_BuildStats.treeletOrderCache = EstimateCacheMisses();
+		}
+		else
+		{
+			ReorderNodes();
+			BuildWideNodes();
+
+			//The compressed nodes inherit the order of the wide nodes
+			m_BuildStats.buildOrderCache = EstimateCacheMisses();
+			ReorderWideNodes();
+			m_BuildStats.treeletOrderCache = EstimateCacheMisses();
+
+			if (m_Layout == BVHLayout::Compressed)
+			{
+				BuildCompressedNodes();
+
+				//Only the compressed nodes get traversed
+				m_WideNodes.clear();
+				m_WideNodes.shrink_to_fit();
+			}
+		}
+
+		m_Cost = CalculateCost();
+		m_BuildCost = m_Cost;
+
+		m_BuildStats.buildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+		m_BuildStats.cost = m_Cost;
+		m_BuildStats.nodeCount = static_cast<uint32_t>(m_Nodes.size());
+		m_BuildStats.leafCount = static_cast<uint32_t>(std::count_if(m_Nodes.begin(), m_Nodes.end(), [](const BVHNode& node) { return node.IsLeaf(); }));
+		m_BuildStats.referenceCount = static_cast<uint32_t>(m_PrimitiveIndices.size());
+
+		switch (m_Layout)
+		{
+		case BVHLayout::Binary:
+			m_BuildStats.traversalMemory = m_Nodes.size() * sizeof(BVHNode);
+			break;
+		case BVHLayout::Wide:
+			m_BuildStats.traversalMemory = m_WideNodes.size() * sizeof(BVHWideNode);
+			break;
+		case BVHLayout::Compressed:
+			m_BuildStats.traversalMemory = m_CompressedNodes.size() * sizeof(BVHCompressedNode);
+			break;
+		}
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_WideNodes.clear();
+		m_CompressedNodes.clear();
+		m_WideLaneNodes.clear();
+		m_PrimitiveCount = 0;
+
+		m_Cost = 0.f;
+		m_BuildCost = 0.f;
+	}
+
+	void BVH::Refit(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		assert(minBounds.size() == GetPrimitiveCount() && maxBounds.size() == GetPrimitiveCount());
+
+		UpdateBoundsBottomUp(minBounds, maxBounds);
+		RefitWideNodes();
+
+		m_Cost = CalculateCost();
+	}
+
+	void BVH::UpdateBoundsBottomUp(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		//Children are always stored after their parent, so walking backwards visits them first
+		for (size_t index = m_Nodes.size(); index-- > 0;)
+		{
+			BVHNode& node = m_Nodes[index];
+			if (node.IsLeaf())
+			{
+				UpdateNodeBounds(node, minBounds, maxBounds);
+			}
+			else
+			{
+				const BVHNode& left = m_Nodes[node.leftFirst];
+				const BVHNode& right = m_Nodes[node.leftFirst + 1];
+				node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+				node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+			}
+		}
+	}
+
+	void BVH::Update(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices)
+	{
+		//Refit keeps the node arrays of the last build, so a changed layout needs a full build as well
+		const bool layoutChanged = m_Layout == BVHLayout::Binary ? !m_WideLaneNodes.empty()
+			: (m_Layout == BVHLayout::Wide ? m_WideNodes.empty() : m_CompressedNodes.empty());
+
+		if (IsEmpty() || minBounds.size() != GetPrimitiveCount() || layoutChanged)
+		{
+			Build(minBounds, maxBounds, triangleVertices);
+			return;
+		}
+
+		//Refitted leaves of a spatial split tree fall back to the unclipped primitive bounds
+		Refit(minBounds, maxBounds);
+
+		if (m_Cost > m_BuildCost * RebuildThreshold)
+		{
+			Build(minBounds, maxBounds, triangleVertices);
+		}
+	}
+
+	void BVH::BuildWideNodes()
+	{
+		m_WideNodes.clear();
+		m_CompressedNodes.clear();
+		m_WideLaneNodes.clear();
+
+		if (m_Layout == BVHLayout::Binary || m_Nodes.empty())
+		{
+			return;
+		}
+
+		m_WideNodes.reserve(m_Nodes.size() / 2 + 1);
+		m_WideLaneNodes.reserve(m_WideNodes.capacity() * BVHWideWidth);
+		CollapseNode(0);
+	}
+
+	void BVH::BuildCompressedNodes()
+	{
+		m_CompressedNodes.resize(m_WideNodes.size());
+
+		for (size_t index = 0; index < m_WideNodes.size(); ++index)
+		{
+			QuantizeNode(m_WideNodes[index], m_CompressedNodes[index]);
+		}
+	}
+
+	void BVH::RefitWideNodes()
+	{
+		//Every lane takes the refitted bounds of the binary node it got collapsed from, the children stay as built
+		const auto refitLanes = [&](size_t index, BVHWideNode& wideNode)
+			{
+				for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+				{
+					if (wideNode.child[lane] == BVHWideNode::InvalidChild)
+					{
+						continue;
+					}
+
+					const BVHNode& child = m_Nodes[m_WideLaneNodes[index * BVHWideWidth + lane]];
+					wideNode.minX[lane] = child.minAABB.x;
+					wideNode.minY[lane] = child.minAABB.y;
+					wideNode.minZ[lane] = child.minAABB.z;
+					wideNode.maxX[lane] = child.maxAABB.x;
+					wideNode.maxY[lane] = child.maxAABB.y;
+					wideNode.maxZ[lane] = child.maxAABB.z;
+				}
+			};
+
+		for (size_t index = 0; index < m_WideNodes.size(); ++index)
+		{
+			refitLanes(index, m_WideNodes[index]);
+		}
+
+		//The compressed layout keeps no wide nodes, every node gets requantized on its own grid
+		for (size_t index = 0; index < m_CompressedNodes.size(); ++index)
+		{
+			BVHCompressedNode& node = m_CompressedNodes[index];
+
+			BVHWideNode wideNode{};
+			for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+			{
+				wideNode.child[lane] = node.child[lane];
+				wideNode.primitiveCount[lane] = node.primitiveCount[lane];
+			}
+			refitLanes(index, wideNode);
+			QuantizeNode(wideNode, node);
+		}
+	}
+
+	void BVH::QuantizeNode(const BVHWideNode& wideNode, BVHCompressedNode& node)
+	{
+		//The grid spans the union of the children, inverted (empty) child bounds are left out
+		Vector3 nodeMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 nodeMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+		{
+			if (wideNode.child[lane] == BVHWideNode::InvalidChild
+				|| wideNode.minX[lane] > wideNode.maxX[lane] || wideNode.minY[lane] > wideNode.maxY[lane] || wideNode.minZ[lane] > wideNode.maxZ[lane])
+			{
+				continue;
+			}
+			nodeMin = Vector3::Min(nodeMin, { wideNode.minX[lane], wideNode.minY[lane], wideNode.minZ[lane] });
+			nodeMax = Vector3::Max(nodeMax, { wideNode.maxX[lane], wideNode.maxY[lane], wideNode.maxZ[lane] });
+		}
+
+		if (nodeMin.x > nodeMax.x)
+		{
+			nodeMin = {};
+			nodeMax = {};
+		}
+
+		node.origin = nodeMin;
+
+		//Smallest power of two cell that still fits the node in 255 cells
+		float cellSize[3]{};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			int exponent{};
+			std::frexp((nodeMax[axis] - nodeMin[axis]) / 255.f, &exponent);
+			exponent = std::clamp(exponent, -126, 127);
+
+			node.exponent[axis] = static_cast<int8_t>(exponent);
+			cellSize[axis] = std::ldexp(1.f, exponent);
+		}
+
+		//Round outwards so the quantized boxes always contain the real ones
+		const auto quantizeMin = [&](float value, int axis)
+			{
+				value = std::clamp(value, nodeMin[axis], nodeMax[axis]);
+				int cell = static_cast<int>(std::floor((value - node.origin[axis]) / cellSize[axis]));
+				while (cell > 0 && node.origin[axis] + cell * cellSize[axis] > value)
+				{
+					--cell;
+				}
+				return static_cast<uint8_t>(std::clamp(cell, 0, 255));
+			};
+		const auto quantizeMax = [&](float value, int axis)
+			{
+				value = std::clamp(value, nodeMin[axis], nodeMax[axis]);
+				int cell = static_cast<int>(std::ceil((value - node.origin[axis]) / cellSize[axis]));
+				while (cell < 255 && node.origin[axis] + cell * cellSize[axis] < value)
+				{
+					++cell;
+				}
+				return static_cast<uint8_t>(std::clamp(cell, 0, 255));
+			};
+
+		for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+		{
+			node.child[lane] = wideNode.child[lane];
+			//SplitLargeLeaves keeps every leaf within MaxLeafSize
+			assert(wideNode.primitiveCount[lane] <= MaxLeafSize);
+			node.primitiveCount[lane] = static_cast<uint16_t>(wideNode.primitiveCount[lane]);
+
+			if (wideNode.child[lane] == BVHWideNode::InvalidChild)
+			{
+				continue;
+			}
+
+			node.minX[lane] = quantizeMin(wideNode.minX[lane], 0);
+			node.minY[lane] = quantizeMin(wideNode.minY[lane], 1);
+			node.minZ[lane] = quantizeMin(wideNode.minZ[lane], 2);
+			node.maxX[lane] = quantizeMax(wideNode.maxX[lane], 0);
+			node.maxY[lane] = quantizeMax(wideNode.maxY[lane], 1);
+			node.maxZ[lane] = quantizeMax(wideNode.maxZ[lane], 2);
+		}
+	}
+
+	void BVH::ReorderNodes()
+	{
+		if (m_Nodes.size() < 3)
+		{
+			return;
+		}
+
+		//The root is ordered on its own, every other node together with its sibling (named after the left one)
+		const auto getChildren = [&](uint32_t unit, std::vector<uint32_t>& children)
+			{
+				for (uint32_t index = unit; index <= (unit == 0 ? 0 : unit + 1); ++index)
+				{
+					if (!m_Nodes[index].IsLeaf())
+					{
+						children.push_back(m_Nodes[index].leftFirst);
+					}
+				}
+			};
+		const auto getProbability = [&](uint32_t unit)
+			{
+				const BVHNode& left = m_Nodes[unit];
+				const BVHNode& right = m_Nodes[unit == 0 ? 0 : unit + 1];
+				return SurfaceArea(Vector3::Min(left.minAABB, right.minAABB), Vector3::Max(left.maxAABB, right.maxAABB));
+			};
+
+		const std::vector<uint32_t> order = TreeletOrder(m_Nodes.size(), TreeletSize / (2 * sizeof(BVHNode)), getChildren, getProbability);
+
+		//The larger sibling goes first, occlusion queries visit the children in stored order
+		std::vector<uint32_t> newIndices(m_Nodes.size());
+		uint32_t nodeCount{};
+		for (const uint32_t unit : order)
+		{
+			if (unit == 0)
+			{
+				newIndices[unit] = nodeCount++;
+				continue;
+			}
+
+			const BVHNode& left = m_Nodes[unit];
+			const BVHNode& right = m_Nodes[unit + 1];
+			const bool swap = SurfaceArea(right.minAABB, right.maxAABB) > SurfaceArea(left.minAABB, left.maxAABB);
+			newIndices[unit] = nodeCount + (swap ? 1 : 0);
+			newIndices[unit + 1] = nodeCount + (swap ? 0 : 1);
+			nodeCount += 2;
+		}
+
+		std::vector<BVHNode> nodes(nodeCount);
+		for (const uint32_t unit : order)
+		{
+			for (uint32_t index = unit; index <= (unit == 0 ? 0 : unit + 1); ++index)
+			{
+				BVHNode& node = nodes[newIndices[index]];
+				node = m_Nodes[index];
+				if (!node.IsLeaf())
+				{
+					node.leftFirst = std::min(newIndices[node.leftFirst], newIndices[node.leftFirst + 1]);
+				}
+			}
+		}
+		m_Nodes = std::move(nodes);
+	}
+
+	void BVH::ReorderWideNodes()
+	{
+		const auto getChildren = [&](uint32_t wideIndex, std::vector<uint32_t>& children)
+			{
+				const BVHWideNode& node = m_WideNodes[wideIndex];
+				for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+				{
+					if (node.child[lane] != BVHWideNode::InvalidChild && node.primitiveCount[lane] == 0)
+					{
+						children.push_back(node.child[lane]);
+					}
+				}
+			};
+
+		//A wide node gets visited when a ray hits the union of its children
+		std::vector<float> probabilities(m_WideNodes.size());
+		for (size_t index = 0; index < m_WideNodes.size(); ++index)
+		{
+			const BVHWideNode& node = m_WideNodes[index];
+
+			Vector3 nodeMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 nodeMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+			{
+				if (node.child[lane] != BVHWideNode::InvalidChild)
+				{
+					nodeMin = Vector3::Min(nodeMin, { node.minX[lane], node.minY[lane], node.minZ[lane] });
+					nodeMax = Vector3::Max(nodeMax, { node.maxX[lane], node.maxY[lane], node.maxZ[lane] });
+				}
+			}
+			probabilities[index] = SurfaceArea(nodeMin, nodeMax);
+		}
+
+		const size_t nodeSize = m_Layout == BVHLayout::Compressed ? sizeof(BVHCompressedNode) : sizeof(BVHWideNode);
+		const std::vector<uint32_t> order = TreeletOrder(m_WideNodes.size(), TreeletSize / nodeSize, getChildren,
+			[&](uint32_t wideIndex) { return probabilities[wideIndex]; });
+
+		std::vector<uint32_t> newIndices(m_WideNodes.size());
+		for (uint32_t index = 0; index < order.size(); ++index)
+		{
+			newIndices[order[index]] = index;
+		}
+
+		std::vector<BVHWideNode> nodes(order.size());
+		for (uint32_t index = 0; index < order.size(); ++index)
+		{
+			BVHWideNode& node = nodes[index];
+			node = m_WideNodes[order[index]];
+			for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+			{
+				if (node.child[lane] != BVHWideNode::InvalidChild && node.primitiveCount[lane] == 0)
+				{
+					node.child[lane] = newIndices[node.child[lane]];
+				}
+			}
+		}
+		m_WideNodes = std::move(nodes);
+
+		std::vector<uint32_t> laneNodes(m_WideLaneNodes.size());
+		for (uint32_t index = 0; index < order.size(); ++index)
+		{
+			std::copy_n(m_WideLaneNodes.begin() + order[index] * BVHWideWidth, BVHWideWidth, laneNodes.begin() + index * BVHWideWidth);
+		}
+		m_WideLaneNodes = std::move(laneNodes);
+	}
+
+	BVHCacheStats BVH::EstimateCacheMisses() const
+	{
+		BVHCacheStats stats{};
+		if (m_Nodes.empty())
+		{
+			return stats;
+		}
+
+		const float rootArea = SurfaceArea(m_Nodes[0].minAABB, m_Nodes[0].maxAABB);
+		if (rootArea <= 0.f)
+		{
+			return stats;
+		}
+
+		//The root is assumed to be cached, every other node is loaded when a ray hits its parent's box
+		if (m_Layout == BVHLayout::Binary)
+		{
+			//Visiting a node tests both children, so the sibling pair is loaded as a whole
+			std::vector<uint32_t> pairStarts(m_Nodes.size(), 0);
+			for (const BVHNode& node : m_Nodes)
+			{
+				if (!node.IsLeaf())
+				{
+					pairStarts[node.leftFirst] = node.leftFirst;
+					pairStarts[node.leftFirst + 1] = node.leftFirst;
+				}
+			}
+
+			for (uint32_t index = 0; index < m_Nodes.size(); ++index)
+			{
+				const BVHNode& node = m_Nodes[index];
+				if (node.IsLeaf())
+				{
+					continue;
+				}
+
+				const size_t parentSize = index == 0 ? sizeof(BVHNode) : 2 * sizeof(BVHNode);
+				AddCacheMisses(node.leftFirst * sizeof(BVHNode), 2 * sizeof(BVHNode), pairStarts[index] * sizeof(BVHNode), parentSize,
+					SurfaceArea(node.minAABB, node.maxAABB) / rootArea, stats);
+			}
+			return stats;
+		}
+
+		const size_t nodeSize = m_Layout == BVHLayout::Compressed ? sizeof(BVHCompressedNode) : sizeof(BVHWideNode);
+		for (size_t index = 0; index < m_WideNodes.size(); ++index)
+		{
+			const BVHWideNode& node = m_WideNodes[index];
+			for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+			{
+				if (node.child[lane] == BVHWideNode::InvalidChild || node.primitiveCount[lane] != 0)
+				{
+					continue;
+				}
+
+				const float area = SurfaceArea({ node.minX[lane], node.minY[lane], node.minZ[lane] }, { node.maxX[lane], node.maxY[lane], node.maxZ[lane] });
+				AddCacheMisses(node.child[lane] * nodeSize, nodeSize, index * nodeSize, nodeSize, area / rootArea, stats);
+			}
+		}
+		return stats;
+	}
+
+	uint32_t BVH::CollapseNode(uint32_t nodeIndex)
+	{
+		//Open the child with the largest surface area until the wide node is full (or only leaves are left)
+		uint32_t children[BVHWideWidth]{ nodeIndex };
+		uint32_t childCount{ 1 };
+
+		while (childCount < BVHWideWidth)
+		{
+			int bestChild{ -1 };
+			float bestArea{ -1.f };
+			for (uint32_t index = 0; index < childCount; ++index)
+			{
+				const BVHNode& child = m_Nodes[children[index]];
+				const float area = SurfaceArea(child.minAABB, child.maxAABB);
+				if (!child.IsLeaf() && area > bestArea)
+				{
+					bestArea = area;
+					bestChild = static_cast<int>(index);
+				}
+			}
+
+			if (bestChild < 0)
+			{
+				break;
+			}
+
+			const uint32_t leftIndex = m_Nodes[children[bestChild]].leftFirst;
+			children[bestChild] = leftIndex;
+			children[childCount++] = leftIndex + 1;
+		}
+
+		//Largest children in the first lanes, occlusion queries visit the lanes in stored order
+		std::sort(children, children + childCount, [&](uint32_t a, uint32_t b)
+			{
+				return SurfaceArea(m_Nodes[a].minAABB, m_Nodes[a].maxAABB) > SurfaceArea(m_Nodes[b].minAABB, m_Nodes[b].maxAABB);
+			});
+
+		const uint32_t wideIndex = static_cast<uint32_t>(m_WideNodes.size());
+		m_WideNodes.push_back({});
+		m_WideLaneNodes.resize(m_WideLaneNodes.size() + BVHWideWidth, BVHWideNode::InvalidChild);
+
+		for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+		{
+			BVHWideNode& wideNode = m_WideNodes[wideIndex];
+
+			if (lane >= childCount)
+			{
+				wideNode.child[lane] = BVHWideNode::InvalidChild;
+				wideNode.primitiveCount[lane] = 0;
+				continue;
+			}
+
+			const BVHNode& child = m_Nodes[children[lane]];
+			m_WideLaneNodes[wideIndex * BVHWideWidth + lane] = children[lane];
+			wideNode.minX[lane] = child.minAABB.x;
+			wideNode.minY[lane] = child.minAABB.y;
+			wideNode.minZ[lane] = child.minAABB.z;
+			wideNode.maxX[lane] = child.maxAABB.x;
+			wideNode.maxY[lane] = child.maxAABB.y;
+			wideNode.maxZ[lane] = child.maxAABB.z;
+			wideNode.primitiveCount[lane] = child.primitiveCount;
+
+			if (child.IsLeaf())
+			{
+				wideNode.child[lane] = child.leftFirst;
+			}
+			else
+			{
+				//Collapsing the child grows m_WideNodes, so look the node up again afterwards
+				const uint32_t childWideIndex = CollapseNode(children[lane]);
+				m_WideNodes[wideIndex].child[lane] = childWideIndex;
+			}
+		}
+
+		return wideIndex;
+	}
+
+	float BVH::CalculateCost() const
+	{
+		if (m_Nodes.empty())
+		{
+			return 0.f;
+		}
+
+		const float rootArea = SurfaceArea(m_Nodes[0].minAABB, m_Nodes[0].maxAABB);
+		if (rootArea <= 0.f)
+		{
+			return 0.f;
+		}
+
+		float cost{};
+		for (const BVHNode& node : m_Nodes)
+		{
+			cost += SurfaceArea(node.minAABB, node.maxAABB) * (node.IsLeaf() ? LeafCost(node.primitiveCount) : 1.f);
+		}
+
+		return cost / rootArea;
+	}
+
+	float BVH::LeafCost(uint32_t primitiveCount) const
+	{
+		return static_cast<float>((primitiveCount + m_LeafBlockSize - 1) / m_LeafBlockSize);
+	}
+
+	float BVH::SurfaceArea(const Vector3& minAABB, const Vector3& maxAABB)
+	{
+		const Vector3 extent = maxAABB - minAABB;
+		return std::max(extent.x * extent.y + extent.y * extent.z + extent.z * extent.x, 0.f);
+	}
+
+	void BVH::UpdateNodeBounds(BVHNode& node, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds) const
+	{
+		node.minAABB = { FLT_MAX, FLT_MAX, FLT_MAX };
+		node.maxAABB = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (uint32_t index = node.leftFirst; index < node.leftFirst + node.primitiveCount; ++index)
+		{
+			const uint32_t primitive = m_PrimitiveIndices[index];
+			node.minAABB = Vector3::Min(node.minAABB, minBounds[primitive]);
+			node.maxAABB = Vector3::Max(node.maxAABB, maxBounds[primitive]);
+		}
+	}
+
+	void BVH::SplitLargeLeaves(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		//Leaves the builders could not split (primitives sharing one centroid, or the depth limit) get halved until they fit
+		//Children are appended after their parent, so the loop visits them too
+		for (size_t index = 0; index < m_Nodes.size(); ++index)
+		{
+			if (m_Nodes[index].primitiveCount <= MaxLeafSize)
+			{
+				continue;
+			}
+
+			const uint32_t first = m_Nodes[index].leftFirst;
+			const uint32_t count = m_Nodes[index].primitiveCount;
+
+			BVHNode left{};
+			left.leftFirst = first;
+			left.primitiveCount = count / 2;
+			UpdateNodeBounds(left, minBounds, maxBounds);
+
+			BVHNode right{};
+			right.leftFirst = first + count / 2;
+			right.primitiveCount = count - count / 2;
+			UpdateNodeBounds(right, minBounds, maxBounds);
+
+			m_Nodes[index].leftFirst = static_cast<uint32_t>(m_Nodes.size());
+			m_Nodes[index].primitiveCount = 0;
+			m_Nodes.push_back(left);
+			m_Nodes.push_back(right);
+		}
+	}
+
+	void BVH::Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids)
+	{
+		const uint32_t first = m_Nodes[nodeIndex].leftFirst;
+		const uint32_t count = m_Nodes[nodeIndex].primitiveCount;
+
+		if (count <= 1 || depth >= MaxBuildDepth)
+		{
+			return;
+		}
+
+		const auto begin = m_PrimitiveIndices.begin() + first;
+		const auto end = begin + count;
+
+		//SAH: cost(split) = area(L) * LeafCost(L) + area(R) * LeafCost(R), evaluated at every position of the sorted centroids
+		int bestAxis{ -1 };
+		uint32_t bestSplit{};
+		float bestCost{ FLT_MAX };
+
+		std::vector<float> rightAreas(count);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			std::sort(begin, end, [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+			//Sweep right to left to get the area of every right partition
+			Vector3 rightMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 rightMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t index = count - 1; index > 0; --index)
+			{
+				const uint32_t primitive = m_PrimitiveIndices[first + index];
+				rightMin = Vector3::Min(rightMin, minBounds[primitive]);
+				rightMax = Vector3::Max(rightMax, maxBounds[primitive]);
+				rightAreas[index] = SurfaceArea(rightMin, rightMax);
+			}
+
+			//Sweep left to right and evaluate every split
+			Vector3 leftMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 leftMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t split = 1; split < count; ++split)
+			{
+				const uint32_t primitive = m_PrimitiveIndices[first + split - 1];
+				leftMin = Vector3::Min(leftMin, minBounds[primitive]);
+				leftMax = Vector3::Max(leftMax, maxBounds[primitive]);
+
+				const float cost = SurfaceArea(leftMin, leftMax) * LeafCost(split) + rightAreas[split] * LeafCost(count - split);
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		//Only split when it's cheaper than intersecting every primitive in this node
+		const float nodeArea = SurfaceArea(m_Nodes[nodeIndex].minAABB, m_Nodes[nodeIndex].maxAABB);
+		if (bestAxis < 0 || bestCost + nodeArea * TraversalCost >= nodeArea * LeafCost(count))
+		{
+			return;
+		}
+
+		if (bestAxis != 2)
+		{
+			std::sort(begin, end, [&](uint32_t a, uint32_t b) { return centroids[a][bestAxis] < centroids[b][bestAxis]; });
+		}
+
+		const uint32_t leftIndex = static_cast<uint32_t>(m_Nodes.size());
+
+		BVHNode left{};
+		left.leftFirst = first;
+		left.primitiveCount = bestSplit;
+		UpdateNodeBounds(left, minBounds, maxBounds);
+
+		BVHNode right{};
+		right.leftFirst = first + bestSplit;
+		right.primitiveCount = count - bestSplit;
+		UpdateNodeBounds(right, minBounds, maxBounds);
+
+		m_Nodes.push_back(left);
+		m_Nodes.push_back(right);
+
+		m_Nodes[nodeIndex].leftFirst = leftIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+
+		Subdivide(leftIndex, depth + 1, minBounds, maxBounds, centroids);
+		Subdivide(leftIndex + 1, depth + 1, minBounds, maxBounds, centroids);
+	}
+
+	void BVH::SubdivideBinned(uint32_t nodeIndex, uint32_t depth, uint32_t parallelDepth, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids, std::atomic<uint32_t>& nodesUsed)
+	{
+		BVHNode& node = m_Nodes[nodeIndex];
+		const uint32_t first = node.leftFirst;
+		const uint32_t count = node.primitiveCount;
+
+		if (count <= 1 || depth >= MaxBuildDepth)
+		{
+			return;
+		}
+
+		//Bins are spread over the centroid bounds, not the node bounds
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t index = first; index < first + count; ++index)
+		{
+			centroidMin = Vector3::Min(centroidMin, centroids[m_PrimitiveIndices[index]]);
+			centroidMax = Vector3::Max(centroidMax, centroids[m_PrimitiveIndices[index]]);
+		}
+
+		struct Bin
+		{
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			uint32_t primitiveCount{};
+		};
+
+		int bestAxis{ -1 };
+		uint32_t bestBin{};
+		float bestCost{ FLT_MAX };
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.f)
+			{
+				continue;
+			}
+
+			Bin bins[BinCount]{};
+			const float binScale = BinCount / extent;
+			for (uint32_t index = first; index < first + count; ++index)
+			{
+				const uint32_t primitive = m_PrimitiveIndices[index];
+				const uint32_t binIndex = std::min(BinCount - 1, static_cast<uint32_t>((centroids[primitive][axis] - centroidMin[axis]) * binScale));
+
+				Bin& bin = bins[binIndex];
+				++bin.primitiveCount;
+				bin.minAABB = Vector3::Min(bin.minAABB, minBounds[primitive]);
+				bin.maxAABB = Vector3::Max(bin.maxAABB, maxBounds[primitive]);
+			}
+
+			//Sweep the bin planes from both sides
+			float leftAreas[BinCount - 1]{}, rightAreas[BinCount - 1]{};
+			uint32_t leftCounts[BinCount - 1]{}, rightCounts[BinCount - 1]{};
+
+			Bin left{}, right{};
+			for (uint32_t plane = 0; plane < BinCount - 1; ++plane)
+			{
+				left.primitiveCount += bins[plane].primitiveCount;
+				left.minAABB = Vector3::Min(left.minAABB, bins[plane].minAABB);
+				left.maxAABB = Vector3::Max(left.maxAABB, bins[plane].maxAABB);
+				leftCounts[plane] = left.primitiveCount;
+				leftAreas[plane] = SurfaceArea(left.minAABB, left.maxAABB);
+
+				const uint32_t rightBin = BinCount - 1 - plane;
+				right.primitiveCount += bins[rightBin].primitiveCount;
+				right.minAABB = Vector3::Min(right.minAABB, bins[rightBin].minAABB);
+				right.maxAABB = Vector3::Max(right.maxAABB, bins[rightBin].maxAABB);
+				rightCounts[rightBin - 1] = right.primitiveCount;
+				rightAreas[rightBin - 1] = SurfaceArea(right.minAABB, right.maxAABB);
+			}
+
+			for (uint32_t plane = 0; plane < BinCount - 1; ++plane)
+			{
+				if (leftCounts[plane] == 0 || rightCounts[plane] == 0)
+				{
+					continue;
+				}
+
+				const float cost = leftAreas[plane] * LeafCost(leftCounts[plane]) + rightAreas[plane] * LeafCost(rightCounts[plane]);
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = plane;
+				}
+			}
+		}
+
+		const float nodeArea = SurfaceArea(node.minAABB, node.maxAABB);
+		if (bestAxis < 0 || bestCost + nodeArea * TraversalCost >= nodeArea * LeafCost(count))
+		{
+			return;
+		}
+
+		//Partition the primitives on the chosen bin plane
+		const float binScale = BinCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		const auto middle = std::partition(m_PrimitiveIndices.begin() + first, m_PrimitiveIndices.begin() + first + count, [&](uint32_t primitive)
+			{
+				const uint32_t binIndex = std::min(BinCount - 1, static_cast<uint32_t>((centroids[primitive][bestAxis] - centroidMin[bestAxis]) * binScale));
+				return binIndex <= bestBin;
+			});
+		const uint32_t leftCount = static_cast<uint32_t>(middle - (m_PrimitiveIndices.begin() + first));
+
+		const uint32_t leftIndex = nodesUsed.fetch_add(2);
+
+		BVHNode& left = m_Nodes[leftIndex];
+		left.leftFirst = first;
+		left.primitiveCount = leftCount;
+		UpdateNodeBounds(left, minBounds, maxBounds);
+
+		BVHNode& right = m_Nodes[leftIndex + 1];
+		right.leftFirst = first + leftCount;
+		right.primitiveCount = count - leftCount;
+		UpdateNodeBounds(right, minBounds, maxBounds);
+
+		node.leftFirst = leftIndex;
+		node.primitiveCount = 0;
+
+		if (depth < parallelDepth && count >= ParallelBuildThreshold)
+		{
+			std::future<void> leftTask = std::async(std::launch::async, [&, leftIndex]
+				{
+					SubdivideBinned(leftIndex, depth + 1, parallelDepth, minBounds, maxBounds, centroids, nodesUsed);
+				});
+			SubdivideBinned(leftIndex + 1, depth + 1, parallelDepth, minBounds, maxBounds, centroids, nodesUsed);
+			leftTask.wait();
+		}
+		else
+		{
+			SubdivideBinned(leftIndex, depth + 1, parallelDepth, minBounds, maxBounds, centroids, nodesUsed);
+			SubdivideBinned(leftIndex + 1, depth + 1, parallelDepth, minBounds, maxBounds, centroids, nodesUsed);
+		}
+	}
+
+	void BVH::SubdivideSpatial(uint32_t nodeIndex, uint32_t depth, std::vector<Reference>& references, const std::vector<Vector3>& triangleVertices, float rootArea, uint32_t splitBudget)
+	{
+		const uint32_t count = static_cast<uint32_t>(references.size());
+
+		//Node bounds come from the (clipped) references, not from the full primitives
+		Vector3 nodeMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 nodeMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const Reference& reference : references)
+		{
+			nodeMin = Vector3::Min(nodeMin, reference.minAABB);
+			nodeMax = Vector3::Max(nodeMax, reference.maxAABB);
+
+			const Vector3 centroid = (reference.minAABB + reference.maxAABB) * 0.5f;
+			centroidMin = Vector3::Min(centroidMin, centroid);
+			centroidMax = Vector3::Max(centroidMax, centroid);
+		}
+		m_Nodes[nodeIndex].minAABB = nodeMin;
+		m_Nodes[nodeIndex].maxAABB = nodeMax;
+
+		const auto makeLeaf = [&]()
+			{
+				m_Nodes[nodeIndex].leftFirst = static_cast<uint32_t>(m_PrimitiveIndices.size());
+				m_Nodes[nodeIndex].primitiveCount = count;
+				for (const Reference& reference : references)
+				{
+					m_PrimitiveIndices.push_back(reference.primitive);
+				}
+			};
+
+		if (count <= 1 || depth >= MaxBuildDepth)
+		{
+			makeLeaf();
+			return;
+		}
+
+		struct Bin
+		{
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			uint32_t primitiveCount{};	//Object bins: references in the bin, spatial bins: references starting in the bin
+			uint32_t exitCount{};		//Spatial bins: references ending in the bin
+		};
+
+		//Object split, binned on the reference centroids like SubdivideBinned
+		int objectAxis{ -1 };
+		uint32_t objectBin{};
+		float objectCost{ FLT_MAX };
+		Vector3 objectLeftMin{}, objectLeftMax{}, objectRightMin{}, objectRightMax{};
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.f)
+			{
+				continue;
+			}
+
+			Bin bins[BinCount]{};
+			const float binScale = BinCount / extent;
+			for (const Reference& reference : references)
+			{
+				const float centroid = (reference.minAABB[axis] + reference.maxAABB[axis]) * 0.5f;
+				Bin& bin = bins[std::min(BinCount - 1, static_cast<uint32_t>((centroid - centroidMin[axis]) * binScale))];
+				++bin.primitiveCount;
+				bin.minAABB = Vector3::Min(bin.minAABB, reference.minAABB);
+				bin.maxAABB = Vector3::Max(bin.maxAABB, reference.maxAABB);
+			}
+
+			for (uint32_t plane = 0; plane < BinCount - 1; ++plane)
+			{
+				Bin left{}, right{};
+				for (uint32_t index = 0; index < BinCount; ++index)
+				{
+					Bin& side = index <= plane ? left : right;
+					side.primitiveCount += bins[index].primitiveCount;
+					side.minAABB = Vector3::Min(side.minAABB, bins[index].minAABB);
+					side.maxAABB = Vector3::Max(side.maxAABB, bins[index].maxAABB);
+				}
+
+				if (left.primitiveCount == 0 || right.primitiveCount == 0)
+				{
+					continue;
+				}
+
+				const float cost = SurfaceArea(left.minAABB, left.maxAABB) * LeafCost(left.primitiveCount) + SurfaceArea(right.minAABB, right.maxAABB) * LeafCost(right.primitiveCount);
+				if (cost < objectCost)
+				{
+					objectCost = cost;
+					objectAxis = axis;
+					objectBin = plane;
+					objectLeftMin = left.minAABB;
+					objectLeftMax = left.maxAABB;
+					objectRightMin = right.minAABB;
+					objectRightMax = right.maxAABB;
+				}
+			}
+		}
+
+		//Spatial split, only worth trying when the object split children overlap a lot
+		int spatialAxis{ -1 };
+		float spatialPosition{};
+		float spatialCost{ FLT_MAX };
+		Bin spatialLeft{}, spatialRight{};
+
+		const Vector3 overlapMin = Vector3::Max(objectLeftMin, objectRightMin);
+		const Vector3 overlapMax = Vector3::Min(objectLeftMax, objectRightMax);
+		const bool overlaps = overlapMin.x <= overlapMax.x && overlapMin.y <= overlapMax.y && overlapMin.z <= overlapMax.z;
+		const float overlapArea = objectAxis < 0 ? FLT_MAX : (overlaps ? SurfaceArea(overlapMin, overlapMax) : 0.f);
+
+		if (splitBudget > 0 && overlapArea > SpatialSplitAlpha * rootArea)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float extent = nodeMax[axis] - nodeMin[axis];
+				if (extent <= 0.f)
+				{
+					continue;
+				}
+
+				//Every reference gets clipped into each bin it overlaps
+				Bin bins[BinCount]{};
+				const float binSize = extent / BinCount;
+				for (const Reference& reference : references)
+				{
+					const uint32_t firstBin = std::min(BinCount - 1, static_cast<uint32_t>((reference.minAABB[axis] - nodeMin[axis]) / binSize));
+					const uint32_t lastBin = std::clamp(static_cast<uint32_t>((reference.maxAABB[axis] - nodeMin[axis]) / binSize), firstBin, BinCount - 1);
+
+					for (uint32_t index = firstBin; index <= lastBin; ++index)
+					{
+						const float planeMin = nodeMin[axis] + binSize * index;
+						const float planeMax = index == BinCount - 1 ? nodeMax[axis] : planeMin + binSize;
+
+						Vector3 clippedMin{}, clippedMax{};
+						ClipReference(reference, axis, planeMin, planeMax, triangleVertices, clippedMin, clippedMax);
+
+						bins[index].minAABB = Vector3::Min(bins[index].minAABB, clippedMin);
+						bins[index].maxAABB = Vector3::Max(bins[index].maxAABB, clippedMax);
+					}
+
+					++bins[firstBin].primitiveCount;
+					++bins[lastBin].exitCount;
+				}
+
+				for (uint32_t plane = 0; plane < BinCount - 1; ++plane)
+				{
+					Bin left{}, right{};
+					for (uint32_t index = 0; index < BinCount; ++index)
+					{
+						if (index <= plane)
+						{
+							left.primitiveCount += bins[index].primitiveCount;
+							left.minAABB = Vector3::Min(left.minAABB, bins[index].minAABB);
+							left.maxAABB = Vector3::Max(left.maxAABB, bins[index].maxAABB);
+						}
+						else
+						{
+							right.primitiveCount += bins[index].exitCount;
+							right.minAABB = Vector3::Min(right.minAABB, bins[index].minAABB);
+							right.maxAABB = Vector3::Max(right.maxAABB, bins[index].maxAABB);
+						}
+					}
+
+					if (left.primitiveCount == 0 || right.primitiveCount == 0)
+					{
+						continue;
+					}
+
+					const float cost = SurfaceArea(left.minAABB, left.maxAABB) * LeafCost(left.primitiveCount) + SurfaceArea(right.minAABB, right.maxAABB) * LeafCost(right.primitiveCount);
+					if (cost < spatialCost)
+					{
+						spatialCost = cost;
+						spatialAxis = axis;
+						spatialPosition = nodeMin[axis] + binSize * (plane + 1);
+						spatialLeft = left;
+						spatialRight = right;
+					}
+				}
+			}
+		}
+
+		const float nodeArea = SurfaceArea(nodeMin, nodeMax);
+		if (std::min(objectCost, spatialCost) + nodeArea * TraversalCost >= nodeArea * LeafCost(count))
+		{
+			makeLeaf();
+			return;
+		}
+
+		std::vector<Reference> leftReferences{};
+		std::vector<Reference> rightReferences{};
+
+		if (spatialCost < objectCost)
+		{
+			const float leftArea = SurfaceArea(spatialLeft.minAABB, spatialLeft.maxAABB);
+			const float rightArea = SurfaceArea(spatialRight.minAABB, spatialRight.maxAABB);
+			const float leftCount = static_cast<float>(spatialLeft.primitiveCount);
+			const float rightCount = static_cast<float>(spatialRight.primitiveCount);
+
+			for (const Reference& reference : references)
+			{
+				if (reference.maxAABB[spatialAxis] <= spatialPosition)
+				{
+					leftReferences.push_back(reference);
+					continue;
+				}
+				if (reference.minAABB[spatialAxis] >= spatialPosition)
+				{
+					rightReferences.push_back(reference);
+					continue;
+				}
+
+				//Straddling reference: keep it whole on one side when that's cheaper than splitting it (reference unsplitting)
+				const float splitCost = leftArea * leftCount + rightArea * rightCount;
+				const float leftOnlyCost = SurfaceArea(Vector3::Min(spatialLeft.minAABB, reference.minAABB), Vector3::Max(spatialLeft.maxAABB, reference.maxAABB)) * leftCount + rightArea * (rightCount - 1.f);
+				const float rightOnlyCost = leftArea * (leftCount - 1.f) + SurfaceArea(Vector3::Min(spatialRight.minAABB, reference.minAABB), Vector3::Max(spatialRight.maxAABB, reference.maxAABB)) * rightCount;
+
+				if (splitBudget == 0 || std::min(leftOnlyCost, rightOnlyCost) <= splitCost)
+				{
+					(leftOnlyCost <= rightOnlyCost ? leftReferences : rightReferences).push_back(reference);
+					continue;
+				}
+
+				Reference left{ {}, {}, reference.primitive };
+				Reference right{ {}, {}, reference.primitive };
+				ClipReference(reference, spatialAxis, -FLT_MAX, spatialPosition, triangleVertices, left.minAABB, left.maxAABB);
+				ClipReference(reference, spatialAxis, spatialPosition, FLT_MAX, triangleVertices, right.minAABB, right.maxAABB);
+
+				//A triangle can miss one side even though its AABB straddles the plane
+				const bool leftValid = left.minAABB.x <= left.maxAABB.x && left.minAABB.y <= left.maxAABB.y && left.minAABB.z <= left.maxAABB.z;
+				const bool rightValid = right.minAABB.x <= right.maxAABB.x && right.minAABB.y <= right.maxAABB.y && right.minAABB.z <= right.maxAABB.z;
+				if (leftValid && rightValid)
+				{
+					leftReferences.push_back(left);
+					rightReferences.push_back(right);
+					--splitBudget;
+				}
+				else
+				{
+					(leftValid ? leftReferences : rightReferences).push_back(reference);
+				}
+			}
+		}
+		else
+		{
+			const float binScale = BinCount / (centroidMax[objectAxis] - centroidMin[objectAxis]);
+			for (const Reference& reference : references)
+			{
+				const float centroid = (reference.minAABB[objectAxis] + reference.maxAABB[objectAxis]) * 0.5f;
+				const uint32_t binIndex = std::min(BinCount - 1, static_cast<uint32_t>((centroid - centroidMin[objectAxis]) * binScale));
+				(binIndex <= objectBin ? leftReferences : rightReferences).push_back(reference);
+			}
+		}
+
+		//Unsplitting can move every reference to one side
+		if (leftReferences.empty() || rightReferences.empty())
+		{
+			makeLeaf();
+			return;
+		}
+
+		references.clear();
+		references.shrink_to_fit();
+
+		const uint32_t leftIndex = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.push_back({});
+		m_Nodes.push_back({});
+
+		m_Nodes[nodeIndex].leftFirst = leftIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+
+		//Share the remaining budget by reference count, so the first subtree can't use up all of it
+		const uint32_t leftBudget = static_cast<uint32_t>(static_cast<uint64_t>(splitBudget) * leftReferences.size() / (leftReferences.size() + rightReferences.size()));
+		const uint32_t rightBudget = splitBudget - leftBudget;
+
+		SubdivideSpatial(leftIndex, depth + 1, leftReferences, triangleVertices, rootArea, leftBudget);
+		SubdivideSpatial(leftIndex + 1, depth + 1, rightReferences, triangleVertices, rootArea, rightBudget);
+	}
+
+	void BVH::ClipReference(const Reference& reference, int axis, float planeMin, float planeMax, const std::vector<Vector3>& triangleVertices, Vector3& minAABB, Vector3& maxAABB)
+	{
+		minAABB = reference.minAABB;
+		maxAABB = reference.maxAABB;
+
+		//Without triangles only the AABB itself can be clipped
+		if (!triangleVertices.empty())
+		{
+			Vector3 clippedMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 clippedMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			const Vector3* pVertices = &triangleVertices[reference.primitive * 3];
+			for (int index = 0; index < 3; ++index)
+			{
+				const Vector3& start = pVertices[index];
+				const Vector3& end = pVertices[(index + 1) % 3];
+
+				if (start[axis] >= planeMin && start[axis] <= planeMax)
+				{
+					clippedMin = Vector3::Min(clippedMin, start);
+					clippedMax = Vector3::Max(clippedMax, start);
+				}
+
+				//Points where the edge crosses the slab planes
+				for (const float plane : { planeMin, planeMax })
+				{
+					if ((start[axis] < plane && end[axis] > plane) || (start[axis] > plane && end[axis] < plane))
+					{
+						Vector3 point = start + (end - start) * ((plane - start[axis]) / (end[axis] - start[axis]));
+						point[axis] = plane;
+
+						clippedMin = Vector3::Min(clippedMin, point);
+						clippedMax = Vector3::Max(clippedMax, point);
+					}
+				}
+			}
+
+			//The reference may already be a clipped part of the triangle
+			minAABB = Vector3::Max(minAABB, clippedMin);
+			maxAABB = Vector3::Min(maxAABB, clippedMax);
+		}
+
+		minAABB[axis] = std::max(minAABB[axis], planeMin);
+		maxAABB[axis] = std::min(maxAABB[axis], planeMax);
+	}
+
+	void BVH::BuildLinear(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids)
+	{
+		const uint32_t primitiveCount = static_cast<uint32_t>(centroids.size());
+
+		//Quantize the centroids to 21 bits per axis inside the centroid bounds -> 63-bit Morton codes
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const Vector3& centroid : centroids)
+		{
+			centroidMin = Vector3::Min(centroidMin, centroid);
+			centroidMax = Vector3::Max(centroidMax, centroid);
+		}
+
+		constexpr float gridSize{ static_cast<float>((1 << 21) - 1) };
+		Vector3 gridScale{};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centroidMax[axis] - centroidMin[axis];
+			gridScale[axis] = extent > 0.f ? gridSize / extent : 0.f;
+		}
+
+		std::vector<uint64_t> mortonCodes(primitiveCount);
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			const Vector3 cell = centroids[index] - centroidMin;
+			mortonCodes[index] =
+				ExpandBits(static_cast<uint64_t>(cell.x * gridScale.x)) << 2 |
+				ExpandBits(static_cast<uint64_t>(cell.y * gridScale.y)) << 1 |
+				ExpandBits(static_cast<uint64_t>(cell.z * gridScale.z));
+		}
+
+		//LSD radix sort of the primitive indices on their code, 8 bits per pass
+		std::vector<uint32_t> sortedIndices(primitiveCount);
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			uint32_t offsets[257]{};
+			for (uint32_t primitive : m_PrimitiveIndices)
+			{
+				++offsets[((mortonCodes[primitive] >> shift) & 0xff) + 1];
+			}
+			for (int bucket = 0; bucket < 256; ++bucket)
+			{
+				offsets[bucket + 1] += offsets[bucket];
+			}
+			for (uint32_t primitive : m_PrimitiveIndices)
+			{
+				sortedIndices[offsets[(mortonCodes[primitive] >> shift) & 0xff]++] = primitive;
+			}
+			m_PrimitiveIndices.swap(sortedIndices);
+		}
+
+		std::vector<uint64_t> sortedCodes(primitiveCount);
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			sortedCodes[index] = mortonCodes[m_PrimitiveIndices[index]];
+		}
+
+		//Emit the hierarchy top-down, bounds are filled in afterwards
+		struct Task
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+		};
+		std::vector<Task> tasks{ { 0, 1 } };
+
+		while (!tasks.empty())
+		{
+			const Task task = tasks.back();
+			tasks.pop_back();
+
+			const uint32_t first = m_Nodes[task.nodeIndex].leftFirst;
+			const uint32_t count = m_Nodes[task.nodeIndex].primitiveCount;
+			if (count <= 1 || task.depth >= MaxBuildDepth)
+			{
+				continue;
+			}
+
+			const uint32_t split = FindSplit(sortedCodes, first, first + count - 1);
+			const uint32_t leftIndex = static_cast<uint32_t>(m_Nodes.size());
+
+			BVHNode left{};
+			left.leftFirst = first;
+			left.primitiveCount = split - first + 1;
+
+			BVHNode right{};
+			right.leftFirst = split + 1;
+			right.primitiveCount = count - left.primitiveCount;
+
+			m_Nodes.push_back(left);
+			m_Nodes.push_back(right);
+
+			m_Nodes[task.nodeIndex].leftFirst = leftIndex;
+			m_Nodes[task.nodeIndex].primitiveCount = 0;
+
+			tasks.push_back({ leftIndex, task.depth + 1 });
+			tasks.push_back({ leftIndex + 1, task.depth + 1 });
+		}
+
+		UpdateBoundsBottomUp(minBounds, maxBounds);
+	}
+}
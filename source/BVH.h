@@ -0,0 +1,296 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		uint32_t leftFirst{};		//Inner node: index of the left child (right child is leftFirst + 1), Leaf: first primitive
+		Vector3 maxAABB{};
+		uint32_t primitiveCount{};	//0 for inner nodes
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	//Children per collapsed node: 8 with AVX2 (one __m256 per axis), 4 with SSE
+#if defined(__AVX2__)
+	constexpr uint32_t BVHWideWidth{ 8 };
+#else
+	constexpr uint32_t BVHWideWidth{ 4 };
+#endif
+
+	//One register of BVHWideWidth floats, the SIMD kernels are written once against these wrappers
+	//Compares give all-ones lanes where they hold, Blend takes b where the mask is set
+	namespace SIMD
+	{
+#if defined(__AVX2__)
+		using Lanes = __m256;
+
+		inline Lanes Load(const float* p) { return _mm256_load_ps(p); }
+		inline void Store(float* p, Lanes a) { _mm256_storeu_ps(p, a); }
+		inline Lanes Set(float f) { return _mm256_set1_ps(f); }
+		inline Lanes Zero() { return _mm256_setzero_ps(); }
+
+		inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+		inline Lanes Sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+		inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+		inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+		inline Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+		inline Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+		inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+
+		inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+		inline Lanes CmpGT(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		inline Lanes CmpGE(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+		inline Lanes CmpLT(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		inline Lanes CmpLE(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		inline Lanes CmpNEQ(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+		inline Lanes Blend(Lanes a, Lanes b, Lanes mask) { return _mm256_blendv_ps(a, b, mask); }
+		inline uint32_t MoveMask(Lanes mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask)); }
+
+		//Widens BVHWideWidth bytes to floats
+		inline Lanes Load(const uint8_t* p)
+		{
+			return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+		}
+#else
+		using Lanes = __m128;
+
+		inline Lanes Load(const float* p) { return _mm_load_ps(p); }
+		inline void Store(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+		inline Lanes Set(float f) { return _mm_set1_ps(f); }
+		inline Lanes Zero() { return _mm_setzero_ps(); }
+
+		inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+		inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+		inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+		inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+		inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+		inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+		inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+
+		inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+		inline Lanes CmpGT(Lanes a, Lanes b) { return _mm_cmpgt_ps(a, b); }
+		inline Lanes CmpGE(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+		inline Lanes CmpLT(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+		inline Lanes CmpLE(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+		inline Lanes CmpNEQ(Lanes a, Lanes b) { return _mm_cmpneq_ps(a, b); }
+		inline Lanes Blend(Lanes a, Lanes b, Lanes mask) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+		inline uint32_t MoveMask(Lanes mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask)); }
+
+		//Widens BVHWideWidth bytes to floats, unpacking instead of cvtepu8 since that needs SSE4.1
+		inline Lanes Load(const uint8_t* p)
+		{
+			int packed{};
+			std::memcpy(&packed, p, sizeof(packed));
+
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		}
+#endif
+	}
+
+	//Collapsed node, the child bounds are stored per axis so a single SIMD slab test covers all children
+	//Cache line aligned, 256 bytes for 8 children, 128 bytes for 4 children
+	struct alignas(64) BVHWideNode
+	{
+		static constexpr uint32_t InvalidChild{ 0xFFFFFFFF };
+
+		float minX[BVHWideWidth]{};
+		float minY[BVHWideWidth]{};
+		float minZ[BVHWideWidth]{};
+		float maxX[BVHWideWidth]{};
+		float maxY[BVHWideWidth]{};
+		float maxZ[BVHWideWidth]{};
+
+		uint32_t child[BVHWideWidth]{};				//Inner child: wide node index, Leaf child: first primitive, InvalidChild for empty lanes
+		uint32_t primitiveCount[BVHWideWidth]{};	//0 for inner children
+	};
+
+	//Compressed version of BVHWideNode: child bounds are 8-bit offsets on a per node grid
+	//64 bytes (one cache line) for 4 children, 128 bytes for 8 children
+	struct alignas(64) BVHCompressedNode
+	{
+		Vector3 origin{};			//Min corner of the grid
+		int8_t exponent[3]{};		//Cell size per axis is 2^exponent
+		uint8_t padding{};
+
+		uint8_t minX[BVHWideWidth]{};
+		uint8_t minY[BVHWideWidth]{};
+		uint8_t minZ[BVHWideWidth]{};
+		uint8_t maxX[BVHWideWidth]{};
+		uint8_t maxY[BVHWideWidth]{};
+		uint8_t maxZ[BVHWideWidth]{};
+
+		uint32_t child[BVHWideWidth]{};				//Same meaning as BVHWideNode::child
+		uint16_t primitiveCount[BVHWideWidth]{};
+	};
+
+	enum class BVHLayout
+	{
+		Binary,		//Traverse the binary nodes, one scalar slab test per child
+		Wide,		//Traverse the collapsed BVHWideNode tree, one SIMD slab test per BVHWideWidth children
+		Compressed	//Same tree as Wide, but stored as quantized BVHCompressedNodes (about 3x smaller)
+	};
+
+	enum class BVHBuilder
+	{
+		SweepSAH,	//Exact SAH over every sorted centroid, best quality, single threaded
+		BinnedSAH,	//SAH evaluated over a fixed number of bins, subtrees are built on worker threads
+		LBVH,		//Linear BVH, splits the Morton order of the centroids, fastest build for geometry rebuilt every frame
+		SpatialSAH	//SBVH, binned SAH that may also split primitives on a plane, best for long thin triangles, single threaded
+	};
+
+	//Traversal cache behaviour estimated from the SAH visit probabilities of the nodes
+	//A visit misses for every cache line (L1) or treelet block (L2) of the node that its parent doesn't share
+	struct BVHCacheStats
+	{
+		float l1Misses{};	//Expected per ray
+		float l2Misses{};
+	};
+
+	struct BVHBuildStats
+	{
+		float buildTime{};		//Milliseconds spent in the last full build
+		float cost{};			//SAH cost right after the last full build
+		uint32_t nodeCount{};
+		uint32_t leafCount{};
+		uint32_t referenceCount{};	//Primitive references in the leaves, higher than the primitive count after spatial splits
+		size_t traversalMemory{};	//Bytes of the node array the current layout traverses
+
+		//Estimated once per full build, refits leave them alone
+		BVHCacheStats buildOrderCache{};	//Nodes of the current layout in the order they got built (collapsed)
+		BVHCacheStats treeletOrderCache{};	//Same nodes after the treelet reorder
+	};
+
+	//Bounding Volume Hierarchy over a set of primitive AABBs
+	//Nodes are stored in a flat array, the root is always node 0
+	class BVH final
+	{
+	public:
+		//Deepest tree the traversal stacks are sized for
+		static constexpr uint32_t MaxDepth{ 64 };
+
+		//Most primitives in one leaf, BVHCompressedNode stores the leaf sizes in 16 bits
+		static constexpr uint32_t MaxLeafSize{ 0xFFFF };
+
+		//The builders stop this many levels above MaxDepth, enough for SplitLargeLeaves to halve any leaf below MaxLeafSize
+		static constexpr uint32_t MaxBuildDepth{ MaxDepth - 17 };
+
+		//Refitted trees get rebuilt once their SAH cost grows past this factor of the cost right after the build
+		static constexpr float RebuildThreshold{ 1.5f };
+
+		//SAH cost of visiting an inner node, relative to testing one leaf block. Without it the builders split down
+		//to single primitives and leave the SIMD leaf tests with one filled lane
+		static constexpr float TraversalCost{ .5f };
+
+		//Binned builder settings
+		static constexpr uint32_t BinCount{ 16 };
+		static constexpr uint32_t ParallelBuildThreshold{ 4096 };	//Nodes with fewer primitives are built on the current thread
+
+		//Spatial split builder settings
+		static constexpr float SpatialSplitAlpha{ 1e-5f };	//Only try spatial splits when the object split children overlap more than this fraction of the root area
+		static constexpr float SpatialSplitBudget{ 1.f };	//Extra references allowed, as a fraction of the primitive count
+
+		//Node memory layout, treelets are filled with the most likely visited nodes first so the top levels share one block
+		static constexpr size_t CacheLineSize{ 64 };
+		static constexpr size_t TreeletSize{ 4096 };	//Bytes of nodes per treelet
+
+		/**
+		 * \brief Builds the hierarchy using the surface area heuristic, with the builder set through SetBuilder
+		 * \param minBounds min corner of the AABB of every primitive
+		 * \param maxBounds max corner of the AABB of every primitive
+		 * \param triangleVertices 3 vertices per primitive, lets BVHBuilder::SpatialSAH clip triangles instead of their AABB
+		 */
+		void Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices = {});
+		void Clear();
+
+		void SetBuilder(BVHBuilder builder) { m_Builder = builder; }
+		BVHBuilder GetBuilder() const { return m_Builder; }
+
+		//Primitives the leaf test intersects at once (SIMD width, see TriangleBlock), the SAH prices a leaf per started block
+		//Takes effect on the next Build
+		void SetLeafBlockSize(uint32_t blockSize) { m_LeafBlockSize = blockSize > 0 ? blockSize : 1; }
+		uint32_t GetLeafBlockSize() const { return m_LeafBlockSize; }
+
+		//Switching layout takes effect on the next Build, Update also rebuilds when the layout changed
+		void SetLayout(BVHLayout layout) { m_Layout = layout; }
+		BVHLayout GetLayout() const { return m_Layout; }
+
+		/**
+		 * \brief Recomputes the node bounds bottom-up, keeping the topology (and wide or compressed nodes) of the last build
+		 * \param minBounds new min corner of every primitive, same primitive count as the last build
+		 * \param maxBounds new max corner of every primitive, same primitive count as the last build
+		 */
+		void Refit(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+
+		//Refits when the primitive count is unchanged, rebuilds when it changed or the refitted tree degraded past RebuildThreshold
+		void Update(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& triangleVertices = {});
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+		const std::vector<BVHWideNode>& GetWideNodes() const { return m_WideNodes; }
+		const std::vector<BVHCompressedNode>& GetCompressedNodes() const { return m_CompressedNodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+		uint32_t GetPrimitiveCount() const { return m_PrimitiveCount; }
+
+		//SAH cost of the tree relative to its root area (traversal cost of 1, intersection cost of 1 per leaf block)
+		float GetCost() const { return m_Cost; }
+		float GetBuildCost() const { return m_BuildCost; }
+		const BVHBuildStats& GetBuildStats() const { return m_BuildStats; }
+
+		static float SurfaceArea(const Vector3& minAABB, const Vector3& maxAABB);
+
+	private:
+		//Primitive (part) tracked by the spatial split builder
+		struct Reference
+		{
+			Vector3 minAABB{};
+			Vector3 maxAABB{};
+			uint32_t primitive{};
+		};
+
+		std::vector<BVHNode> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+		std::vector<BVHWideNode> m_WideNodes{};
+		std::vector<BVHCompressedNode> m_CompressedNodes{};
+		//Binary node every lane of the wide (or compressed) nodes got collapsed from, Refit copies their bounds in place
+		std::vector<uint32_t> m_WideLaneNodes{};
+		uint32_t m_PrimitiveCount{};
+
+		BVHBuilder m_Builder{ BVHBuilder::BinnedSAH };
+		BVHLayout m_Layout{ BVHLayout::Wide };
+		uint32_t m_LeafBlockSize{ 1 };
+
+		float m_Cost{};
+		float m_BuildCost{};
+		BVHBuildStats m_BuildStats{};
+
+		float LeafCost(uint32_t primitiveCount) const;
+		float CalculateCost() const;
+		void ReorderNodes();
+		void ReorderWideNodes();
+		BVHCacheStats EstimateCacheMisses() const;
+		void BuildWideNodes();
+		void BuildCompressedNodes();
+		void RefitWideNodes();
+		static void QuantizeNode(const BVHWideNode& wideNode, BVHCompressedNode& node);
+		uint32_t CollapseNode(uint32_t nodeIndex);
+		void UpdateNodeBounds(BVHNode& node, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds) const;
+		void SplitLargeLeaves(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		void Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids);
+		void BuildLinear(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids);
+		void UpdateBoundsBottomUp(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		void SubdivideSpatial(uint32_t nodeIndex, uint32_t depth, std::vector<Reference>& references, const std::vector<Vector3>& triangleVertices, float rootArea, uint32_t splitBudget);
+		static void ClipReference(const Reference& reference, int axis, float planeMin, float planeMax, const std::vector<Vector3>& triangleVertices, Vector3& minAABB, Vector3& maxAABB);
+		void SubdivideBinned(uint32_t nodeIndex, uint32_t depth, uint32_t parallelDepth, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds, const std::vector<Vector3>& centroids, std::atomic<uint32_t>& nodesUsed);
+	};
+}
@@ -1,7 +1,10 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <numeric>
 
 #include "Math.h"
+#include "AccelerationStructure.h"
 #include "vector"
 
 namespace dae
@@ -15,6 +18,21 @@ namespace dae
 		unsigned char materialIndex{ 0 };
 	};
 
+	//Spheres per SphereBlock, 8 with AVX2 and 4 with SSE like the collapsed BVH nodes
+	constexpr uint32_t SphereBlockWidth{ BVHWideWidth };
+
+	//Spheres of one top-level BVH leaf in structure-of-arrays form, so one SIMD test covers SphereBlockWidth spheres
+	//Unused lanes have a negative squared radius, which never gives a positive discriminant
+	struct alignas(32) SphereBlock
+	{
+		float originX[SphereBlockWidth]{};
+		float originY[SphereBlockWidth]{};
+		float originZ[SphereBlockWidth]{};
+		float radiusSquared[SphereBlockWidth]{};
+
+		uint32_t sphere[SphereBlockWidth]{};	//Index of the Sphere in every lane
+	};
+
 	struct Plane
 	{
 		Vector3 origin{};
@@ -23,6 +41,23 @@ namespace dae
 		unsigned char materialIndex{ 0 };
 	};
 
+	//Planes per PlaneBlock, 8 with AVX2 and 4 with SSE like the collapsed BVH nodes
+	constexpr uint32_t PlaneBlockWidth{ BVHWideWidth };
+
+	//Planes in structure-of-arrays form, so one SIMD test covers PlaneBlockWidth planes
+	//Unused lanes have a zero normal, their 0 / 0 distance fails every compare
+	struct alignas(32) PlaneBlock
+	{
+		float originX[PlaneBlockWidth]{};
+		float originY[PlaneBlockWidth]{};
+		float originZ[PlaneBlockWidth]{};
+		float normalX[PlaneBlockWidth]{};
+		float normalY[PlaneBlockWidth]{};
+		float normalZ[PlaneBlockWidth]{};
+
+		uint32_t plane[PlaneBlockWidth]{};	//Index of the Plane in every lane
+	};
+
 	enum class TriangleCullMode
 	{
 		FrontFaceCulling,
@@ -54,6 +89,103 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Intersection data of one triangle, precomputed so the hit test only does the Moller-Trumbore arithmetic
+	struct TriangleRecord
+	{
+		TriangleRecord() = default;
+		TriangleRecord(const Vector3& _v0, const Vector3& _v1, const Vector3& _v2) :
+			v0{ _v0 }, edge1{ _v1 - _v0 }, edge2{ _v2 - _v0 } {}
+
+		Vector3 v0{};
+		Vector3 edge1{};	//v1 - v0
+		Vector3 edge2{};	//v2 - v0, Cross(edge1, edge2) is the (unnormalized) geometric normal
+	};
+
+	//Vertex of a compact mesh (see TriangleMesh::Compact), 16 bits per axis on a grid over the object space AABB
+	struct QuantizedPosition
+	{
+		uint16_t x{};
+		uint16_t y{};
+		uint16_t z{};
+	};
+
+	//Unit vector in 4 bytes: projected onto the octahedron |x| + |y| + |z| = 1 with the lower half folded over the upper one,
+	//then stored as 16-bit snorm
+	struct OctahedralNormal
+	{
+		OctahedralNormal() = default;
+		explicit OctahedralNormal(const Vector3& normal)
+		{
+			const float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+			if (sum == 0.f)
+			{
+				return;
+			}
+
+			float u = normal.x / sum;
+			float v = normal.y / sum;
+			if (normal.z < 0.f)
+			{
+				const float foldedU = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+				v = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+				u = foldedU;
+			}
+
+			x = static_cast<int16_t>(std::round(std::clamp(u, -1.f, 1.f) * 32767.f));
+			y = static_cast<int16_t>(std::round(std::clamp(v, -1.f, 1.f) * 32767.f));
+		}
+
+		Vector3 Decode() const
+		{
+			Vector3 normal{ x / 32767.f, y / 32767.f, 0.f };
+			normal.z = 1.f - std::abs(normal.x) - std::abs(normal.y);
+			if (normal.z < 0.f)
+			{
+				const float unfoldedX = (1.f - std::abs(normal.y)) * (normal.x >= 0.f ? 1.f : -1.f);
+				normal.y = (1.f - std::abs(normal.x)) * (normal.y >= 0.f ? 1.f : -1.f);
+				normal.x = unfoldedX;
+			}
+			return normal.Normalized();
+		}
+
+		int16_t x{};
+		int16_t y{};
+	};
+
+	//Triangles per TriangleBlock, 8 with AVX2 and 4 with SSE like the collapsed BVH nodes
+	constexpr uint32_t TriangleBlockWidth{ BVHWideWidth };
+
+	//TriangleRecords of one BVH leaf in structure-of-arrays form, so one SIMD test covers TriangleBlockWidth triangles
+	//Unused lanes are all zero, which never passes the determinant test
+	struct alignas(32) TriangleBlock
+	{
+		float v0X[TriangleBlockWidth]{};
+		float v0Y[TriangleBlockWidth]{};
+		float v0Z[TriangleBlockWidth]{};
+		float edge1X[TriangleBlockWidth]{};
+		float edge1Y[TriangleBlockWidth]{};
+		float edge1Z[TriangleBlockWidth]{};
+		float edge2X[TriangleBlockWidth]{};
+		float edge2Y[TriangleBlockWidth]{};
+		float edge2Z[TriangleBlockWidth]{};
+
+		uint32_t triangle[TriangleBlockWidth]{};	//Index of the TriangleRecord in every lane
+
+		void SetLane(uint32_t lane, const TriangleRecord& record, uint32_t triangleIndex)
+		{
+			v0X[lane] = record.v0.x;
+			v0Y[lane] = record.v0.y;
+			v0Z[lane] = record.v0.z;
+			edge1X[lane] = record.edge1.x;
+			edge1Y[lane] = record.edge1.y;
+			edge1Z[lane] = record.edge1.z;
+			edge2X[lane] = record.edge2.x;
+			edge2Y[lane] = record.edge2.y;
+			edge2Z[lane] = record.edge2.z;
+			triangle[lane] = triangleIndex;
+		}
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -62,15 +194,11 @@ namespace dae
 		{
 			//Calculate Normals
 			CalculateNormals();
-
-			//Update Transforms
-			UpdateTransforms();
 		}
 
 		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, const std::vector<Vector3>& _normals, TriangleCullMode _cullMode) :
 			positions(_positions), indices(_indices), normals(_normals), cullMode(_cullMode)
 		{
-			UpdateTransforms();
 		}
 
 		std::vector<Vector3> positions{};
@@ -90,8 +218,46 @@ namespace dae
 		Vector3 transformedMinAABB;
 		Vector3 transformedMaxAABB;
 
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
+		//Object to world (and back), rays get transformed into object space instead of transforming every vertex
+		Matrix worldTransform{};
+		Matrix inverseWorldTransform{};
+		//Set by UpdateTransforms, the scene only refits its top level when a mesh moved
+		bool transformChanged{ true };
+		//Set by UpdateTransforms when worldTransform has a negative determinant (mirrors), which reverses the winding in world space
+		bool mirrored{ false };
+
+		//Object space acceleration structure over the triangles, primitive i is the triangle at indices[i * 3]
+		//Pick the type and BVH builder per mesh before the first UpdateTransforms (LBVH for geometry that gets rebuilt often, SpatialSAH for long thin triangles)
+		//The constructors leave the build to that first UpdateTransforms as well
+		AccelerationStructure accelerationStructure{};
+		//Set by Scene::SetMeshAccelerationType, Scene::SetAccelerationType leaves the type of the mesh alone then
+		bool keepAccelerationType{ false };
+
+		//Object space intersection data per triangle, same indexing as the primitives of the acceleration structure
+		std::vector<TriangleRecord> triangleRecords{};
+
+		//BVH only: the triangles of every leaf packed in blocks, the leaf whose primitives start at index first uses
+		//the blocks from triangleBlocks[leafBlockStarts[first]] on
+		std::vector<TriangleBlock> triangleBlocks{};
+		std::vector<uint32_t> leafBlockStarts{};
+
+		//Compact storage (see Compact), replaces positions, normals, triangleRecords, triangleBlocks and leafBlockStarts
+		//Vertex i sits at quantizationOrigin + quantizedPositions[i] * quantizationStep
+		std::vector<QuantizedPosition> quantizedPositions{};
+		std::vector<OctahedralNormal> octahedralNormals{};	//One per triangle, the normalized Cross(edge1, edge2) of the decoded triangle
+		std::vector<uint16_t> shortIndices{};	//Replaces indices when every vertex index fits in 16 bits
+		Vector3 quantizationOrigin{};
+		Vector3 quantizationStep{};
+
+		//Instances share the geometry and acceleration structure of their source mesh and only own a transform (see Scene::AddTriangleMeshInstance)
+		//The source is mesh instanceSourceIndex of the scene, which points pInstanceSource at it again whenever its mesh list moves
+		const TriangleMesh* pInstanceSource{ nullptr };
+		uint32_t instanceSourceIndex{};
+
+		const TriangleMesh& GetGeometry() const
+		{
+			return pInstanceSource ? *pInstanceSource : *this;
+		}
 
 		void Translate(const Vector3& translation)
 		{
@@ -116,8 +282,34 @@ namespace dae
 			scaleTransform = Matrix::CreateScale(scale);
 		}
 
+		//Cull mode for the object space hit tests, front and back swap under a mirroring transform
+		TriangleCullMode GetObjectCullMode() const
+		{
+			if (!mirrored)
+			{
+				return cullMode;
+			}
+
+			switch (cullMode)
+			{
+			case TriangleCullMode::BackFaceCulling:
+				return TriangleCullMode::FrontFaceCulling;
+			case TriangleCullMode::FrontFaceCulling:
+				return TriangleCullMode::BackFaceCulling;
+			default:
+				return cullMode;
+			}
+		}
+
 		void AppendTriangle(const Triangle& triangle, bool ignoreTransformUpdate = false)
 		{
+			//Compact meshes dropped their positions and indices
+			assert(!IsCompact() && "Compact meshes are frozen");
+			if (IsCompact())
+			{
+				return;
+			}
+
 			int startIndex = static_cast<int>(positions.size());
 
 			positions.push_back(triangle.v0);
@@ -158,24 +350,407 @@ namespace dae
 			}
 		}
 
+		/**
+		 * \brief Mesh optimization after loading: welds vertices with identical positions, then sorts the triangles along the
+		 * Morton curve of their centroids and the vertices in order of first use, so triangles close in space are close in memory.
+		 * Per-triangle normals move along with their triangle. Call before UpdateTransforms builds the acceleration structure
+		 */
+		void OptimizeLayout()
+		{
+			assert(!IsCompact() && "Compact meshes are frozen");
+			if (IsCompact())
+			{
+				return;
+			}
+
+			const size_t triangleCount = indices.size() / 3;
+			if (triangleCount == 0)
+			{
+				return;
+			}
+
+			//Weld: vertices sorted by position, every run of equal positions maps onto its first vertex
+			std::vector<uint32_t> sortedVertices(positions.size());
+			std::iota(sortedVertices.begin(), sortedVertices.end(), 0u);
+			std::sort(sortedVertices.begin(), sortedVertices.end(), [this](uint32_t a, uint32_t b)
+				{
+					const Vector3& pa = positions[a];
+					const Vector3& pb = positions[b];
+					if (pa.x != pb.x) return pa.x < pb.x;
+					if (pa.y != pb.y) return pa.y < pb.y;
+					if (pa.z != pb.z) return pa.z < pb.z;
+					return a < b;
+				});
+
+			std::vector<uint32_t> weldedVertex(positions.size());
+			for (size_t index = 0; index < sortedVertices.size(); ++index)
+			{
+				const uint32_t vertex = sortedVertices[index];
+				if (index > 0)
+				{
+					const uint32_t previous = sortedVertices[index - 1];
+					if (positions[previous].x == positions[vertex].x && positions[previous].y == positions[vertex].y && positions[previous].z == positions[vertex].z)
+					{
+						weldedVertex[vertex] = weldedVertex[previous];
+						continue;
+					}
+				}
+				weldedVertex[vertex] = vertex;
+			}
+
+			//Morton codes of the triangle centroids, quantized to 21 bits per axis inside the centroid bounds
+			std::vector<Vector3> centroids(triangleCount);
+			Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+			{
+				centroids[triangle] = (positions[indices[triangle * 3]] + positions[indices[triangle * 3 + 1]] + positions[indices[triangle * 3 + 2]]) / 3.f;
+				centroidMin = Vector3::Min(centroidMin, centroids[triangle]);
+				centroidMax = Vector3::Max(centroidMax, centroids[triangle]);
+			}
+
+			constexpr float gridSize{ static_cast<float>((1 << 21) - 1) };
+			Vector3 gridScale{};
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float extent = centroidMax[axis] - centroidMin[axis];
+				gridScale[axis] = extent > 0.f ? gridSize / extent : 0.f;
+			}
+
+			std::vector<uint64_t> mortonCodes(triangleCount);
+			for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+			{
+				const Vector3 cell = centroids[triangle] - centroidMin;
+				mortonCodes[triangle] =
+					ExpandBits(static_cast<uint64_t>(cell.x * gridScale.x)) << 2 |
+					ExpandBits(static_cast<uint64_t>(cell.y * gridScale.y)) << 1 |
+					ExpandBits(static_cast<uint64_t>(cell.z * gridScale.z));
+			}
+
+			std::vector<uint32_t> sortedTriangles(triangleCount);
+			std::iota(sortedTriangles.begin(), sortedTriangles.end(), 0u);
+			std::stable_sort(sortedTriangles.begin(), sortedTriangles.end(), [&mortonCodes](uint32_t a, uint32_t b)
+				{
+					return mortonCodes[a] < mortonCodes[b];
+				});
+
+			//Rebuild in triangle order, every welded vertex gets its new index on first use so unreferenced vertices drop out
+			const bool normalPerTriangle = normals.size() == triangleCount;
+
+			std::vector<int> newVertex(positions.size(), -1);
+			std::vector<Vector3> newPositions{};
+			std::vector<Vector3> newNormals{};
+			std::vector<int> newIndices{};
+			newPositions.reserve(positions.size());
+			newIndices.reserve(triangleCount * 3);
+			if (normalPerTriangle)
+			{
+				newNormals.reserve(triangleCount);
+			}
+
+			for (uint32_t triangle : sortedTriangles)
+			{
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					const uint32_t vertex = weldedVertex[indices[triangle * 3 + corner]];
+					if (newVertex[vertex] < 0)
+					{
+						newVertex[vertex] = static_cast<int>(newPositions.size());
+						newPositions.push_back(positions[vertex]);
+					}
+					newIndices.push_back(newVertex[vertex]);
+				}
+
+				if (normalPerTriangle)
+				{
+					newNormals.push_back(normals[triangle]);
+				}
+			}
+
+			positions.swap(newPositions);
+			indices.swap(newIndices);
+			if (normalPerTriangle)
+			{
+				normals.swap(newNormals);
+			}
+		}
+
+		/**
+		 * \brief Switches to compact storage for large meshes: positions quantized to 16 bits per axis over the object space AABB,
+		 * octahedral normals and 16-bit indices when there are at most 65536 vertices. The hit tests decode the triangles themselves,
+		 * so the triangle records and blocks are dropped too. The geometry is frozen afterwards (AppendTriangle and OptimizeLayout
+		 * refuse compact meshes), only the transforms still change
+		 */
+		void Compact()
+		{
+			if (IsCompact() || pInstanceSource || positions.empty())
+			{
+				return;
+			}
+
+			Vector3 positionMin{ positions[0] };
+			Vector3 positionMax{ positions[0] };
+			for (const Vector3& position : positions)
+			{
+				positionMin = Vector3::Min(position, positionMin);
+				positionMax = Vector3::Max(position, positionMax);
+			}
+
+			quantizationOrigin = positionMin;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				quantizationStep[axis] = (positionMax[axis] - positionMin[axis]) / 65535.f;
+			}
+
+			const auto quantize = [this](float value, int axis)
+				{
+					if (quantizationStep[axis] == 0.f)
+					{
+						return uint16_t{ 0 };
+					}
+					return static_cast<uint16_t>(std::clamp(std::round((value - quantizationOrigin[axis]) / quantizationStep[axis]), 0.f, 65535.f));
+				};
+
+			quantizedPositions.reserve(positions.size());
+			for (const Vector3& position : positions)
+			{
+				quantizedPositions.push_back(QuantizedPosition{ quantize(position.x, 0), quantize(position.y, 1), quantize(position.z, 2) });
+			}
+
+			if (positions.size() <= 65536)
+			{
+				shortIndices.assign(indices.begin(), indices.end());
+				std::vector<int>().swap(indices);
+			}
+
+			std::vector<Vector3>().swap(positions);
+			std::vector<Vector3>().swap(normals);
+			std::vector<TriangleRecord>().swap(triangleRecords);
+			std::vector<TriangleBlock>().swap(triangleBlocks);
+			std::vector<uint32_t>().swap(leafBlockStarts);
+
+			//Normals of the decoded triangles rather than the loaded ones, so they always match the winding the hit tests see
+			const uint32_t triangleCount = GetTriangleCount();
+			octahedralNormals.reserve(triangleCount);
+			for (uint32_t triangle = 0; triangle < triangleCount; ++triangle)
+			{
+				const TriangleRecord record = GetTriangleRecord(triangle);
+				octahedralNormals.emplace_back(Vector3::Cross(record.edge1, record.edge2));
+			}
+
+			//Refit to the decoded triangles
+			UpdateAccelerationStructure();
+			UpdateTransformedAABB(worldTransform);
+		}
+
+		//Bytes taken by the geometry and the per-triangle intersection data, acceleration structure not included
+		size_t GetGeometrySize() const
+		{
+			return positions.size() * sizeof(Vector3) + normals.size() * sizeof(Vector3) + indices.size() * sizeof(int) +
+				triangleRecords.size() * sizeof(TriangleRecord) + triangleBlocks.size() * sizeof(TriangleBlock) + leafBlockStarts.size() * sizeof(uint32_t) +
+				quantizedPositions.size() * sizeof(QuantizedPosition) + octahedralNormals.size() * sizeof(OctahedralNormal) + shortIndices.size() * sizeof(uint16_t);
+		}
+
+		bool IsCompact() const
+		{
+			return !quantizedPositions.empty();
+		}
+
+		Vector3 DecodePosition(const QuantizedPosition& quantized) const
+		{
+			return Vector3{
+				quantizationOrigin.x + quantized.x * quantizationStep.x,
+				quantizationOrigin.y + quantized.y * quantizationStep.y,
+				quantizationOrigin.z + quantized.z * quantizationStep.z
+			};
+		}
+
+		uint32_t GetVertexIndex(size_t index) const
+		{
+			return shortIndices.empty() ? static_cast<uint32_t>(indices[index]) : shortIndices[index];
+		}
+
+		uint32_t GetTriangleCount() const
+		{
+			return static_cast<uint32_t>((shortIndices.empty() ? indices.size() : shortIndices.size()) / 3);
+		}
+
+		//Vertex at indices[index], decoded for compact meshes
+		Vector3 GetVertex(size_t index) const
+		{
+			return IsCompact() ? DecodePosition(quantizedPositions[GetVertexIndex(index)]) : positions[indices[index]];
+		}
+
+		//Intersection data of a triangle, decoded on the fly for compact meshes
+		TriangleRecord GetTriangleRecord(uint32_t triangle) const
+		{
+			if (!IsCompact())
+			{
+				return triangleRecords[triangle];
+			}
+
+			return TriangleRecord{
+				DecodePosition(quantizedPositions[GetVertexIndex(triangle * 3)]),
+				DecodePosition(quantizedPositions[GetVertexIndex(triangle * 3 + 1)]),
+				DecodePosition(quantizedPositions[GetVertexIndex(triangle * 3 + 2)])
+			};
+		}
+
+		//Object space unit normal, front faces wind counterclockwise around it
+		Vector3 GetTriangleNormal(uint32_t triangle) const
+		{
+			if (IsCompact())
+			{
+				return octahedralNormals[triangle].Decode();
+			}
+
+			const TriangleRecord& record = triangleRecords[triangle];
+			return Vector3::Cross(record.edge1, record.edge2).Normalized();
+		}
+
+		/**
+		 * \brief Calls blockTest(const TriangleBlock&) for the blocks of the BVH leaf whose primitives start at first, until it returns true
+		 * Compact meshes decode every block on the fly
+		 */
+		template<typename BlockTest>
+		bool ForEachLeafBlock(uint32_t first, uint32_t count, BlockTest&& blockTest) const
+		{
+			if (!IsCompact())
+			{
+				const uint32_t blockStart = leafBlockStarts[first];
+				for (uint32_t block = blockStart; block < blockStart + (count + TriangleBlockWidth - 1) / TriangleBlockWidth; ++block)
+				{
+					if (blockTest(triangleBlocks[block]))
+					{
+						return true;
+					}
+				}
+				return false;
+			}
+
+			const std::vector<uint32_t>& primitiveIndices = accelerationStructure.GetBVH().GetPrimitiveIndices();
+			for (uint32_t offset = 0; offset < count; offset += TriangleBlockWidth)
+			{
+				TriangleBlock block{};
+				for (uint32_t lane = 0; lane < TriangleBlockWidth && offset + lane < count; ++lane)
+				{
+					const uint32_t triangle = primitiveIndices[first + offset + lane];
+					block.SetLane(lane, GetTriangleRecord(triangle), triangle);
+				}
+
+				if (blockTest(block))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
 		void UpdateTransforms()
 		{
-			const Matrix transform = scaleTransform * rotationTransform * translationTransform;
+			worldTransform = scaleTransform * rotationTransform * translationTransform;
+			inverseWorldTransform = Matrix::Inverse(worldTransform);
+			transformChanged = true;
+			mirrored = Vector3::Dot(worldTransform.GetAxisX(), Vector3::Cross(worldTransform.GetAxisY(), worldTransform.GetAxisZ())) < 0.f;
 
-			transformedPositions.clear();
-			for (size_t index = 0; index < positions.size(); index++)
+			//Geometry is only (re)built when triangles got added or the structure got cleared, call UpdateAccelerationStructure manually after moving vertices
+			if (!pInstanceSource && accelerationStructure.GetPrimitiveCount() != GetTriangleCount())
 			{
-				transformedPositions.push_back(transform.TransformPoint(positions[index]));
+				UpdateAccelerationStructure();
 			}
 
-			transformedNormals.clear();
-			for (size_t index = 0; index < normals.size(); index++)
+			UpdateTransformedAABB(worldTransform);
+		}
+
+		void UpdateAccelerationStructure()
+		{
+			//Bounds and intersection records of every (object space) triangle, compact meshes decode their triangles during the hit tests instead
+			const size_t triangleCount = GetTriangleCount();
+
+			std::vector<Vector3> triangleMin{};
+			std::vector<Vector3> triangleMax{};
+			triangleMin.reserve(triangleCount);
+			triangleMax.reserve(triangleCount);
+
+			triangleRecords.clear();
+			if (!IsCompact())
 			{
-				transformedNormals.push_back(transform.TransformPoint(normals[index]));
+				triangleRecords.reserve(triangleCount);
 			}
 
-			UpdateTransformedAABB(transform);
+			for (size_t index = 0; index < triangleCount * 3; index += 3)
+			{
+				const Vector3 v0 = GetVertex(index);
+				const Vector3 v1 = GetVertex(index + 1);
+				const Vector3 v2 = GetVertex(index + 2);
+
+				triangleMin.push_back(Vector3::Min(v0, Vector3::Min(v1, v2)));
+				triangleMax.push_back(Vector3::Max(v0, Vector3::Max(v1, v2)));
+				if (!IsCompact())
+				{
+					triangleRecords.emplace_back(v0, v1, v2);
+				}
+			}
 
+			//The spatial split builder clips the triangles themselves
+			std::vector<Vector3> triangleVertices{};
+			if (accelerationStructure.GetType() == AccelerationType::BVH && accelerationStructure.GetBVH().GetBuilder() == BVHBuilder::SpatialSAH)
+			{
+				triangleVertices.reserve(triangleCount * 3);
+				for (size_t index = 0; index < triangleCount * 3; ++index)
+				{
+					triangleVertices.push_back(GetVertex(index));
+				}
+			}
+
+			//Leaves get intersected one TriangleBlock at a time
+			accelerationStructure.GetBVH().SetLeafBlockSize(TriangleBlockWidth);
+
+			//A BVH only refits while the triangle count is unchanged, rebuilds once the refitted tree degraded too far
+			accelerationStructure.Update(triangleMin, triangleMax, triangleVertices);
+			UpdateTriangleBlocks();
+
+			//Object space AABB of the referenced vertices
+			if (!accelerationStructure.IsEmpty())
+			{
+				minAABB = accelerationStructure.GetMinAABB();
+				maxAABB = accelerationStructure.GetMaxAABB();
+			}
+		}
+
+		void UpdateTriangleBlocks()
+		{
+			triangleBlocks.clear();
+			leafBlockStarts.clear();
+
+			//Compact meshes decode their blocks on the fly in ForEachLeafBlock
+			if (accelerationStructure.GetType() != AccelerationType::BVH || accelerationStructure.IsEmpty() || IsCompact())
+			{
+				return;
+			}
+
+			const BVH& bvh = accelerationStructure.GetBVH();
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+			leafBlockStarts.resize(primitiveIndices.size());
+
+			for (const BVHNode& node : bvh.GetNodes())
+			{
+				if (!node.IsLeaf())
+				{
+					continue;
+				}
+
+				leafBlockStarts[node.leftFirst] = static_cast<uint32_t>(triangleBlocks.size());
+				for (uint32_t offset = 0; offset < node.primitiveCount; offset += TriangleBlockWidth)
+				{
+					TriangleBlock& block = triangleBlocks.emplace_back();
+					for (uint32_t lane = 0; lane < TriangleBlockWidth && offset + lane < node.primitiveCount; ++lane)
+					{
+						const uint32_t triangle = primitiveIndices[node.leftFirst + offset + lane];
+						block.SetLane(lane, triangleRecords[triangle], triangle);
+					}
+				}
+			}
 		}
 
 		void UpdateAABB()
@@ -197,36 +772,29 @@ namespace dae
 		{
 			// AABB Update: be careful -> transform the 8 vertices of the aabb
 			// and calculate the new min and max
-			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB);
+			const Vector3& localMinAABB = GetGeometry().minAABB;
+			const Vector3& localMaxAABB = GetGeometry().maxAABB;
+
+			Vector3 corners[8]
+			{
+				localMinAABB,
+				{ localMaxAABB.x, localMinAABB.y, localMinAABB.z },
+				{ localMaxAABB.x, localMinAABB.y, localMaxAABB.z },
+				{ localMinAABB.x, localMinAABB.y, localMaxAABB.z },
+				{ localMinAABB.x, localMaxAABB.y, localMinAABB.z },
+				{ localMaxAABB.x, localMaxAABB.y, localMinAABB.z },
+				localMaxAABB,
+				{ localMinAABB.x, localMaxAABB.y, localMaxAABB.z }
+			};
+			finalTransform.TransformPoints(corners, corners, 8);
+
+			Vector3 tMinAABB = corners[0];
 			Vector3 tMaxAABB = tMinAABB;
-			// (xmax, ymin, zmin)
-			Vector3 tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (xmax, ymin, zmax)
-			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (xmin, ymin, zmax)
-			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (minx, ymax, zmin)
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (xmax, ymax, zmin)
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (xmax, ymax, zmax)
-			tAABB = finalTransform.TransformPoint(maxAABB);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			// (xmin, ymax, zmax)
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+			for (const Vector3& corner : corners)
+			{
+				tMinAABB = Vector3::Min(corner, tMinAABB);
+				tMaxAABB = Vector3::Max(corner, tMaxAABB);
+			}
 
 			transformedMinAABB = tMinAABB;
 			transformedMaxAABB = tMaxAABB;
@@ -261,6 +829,147 @@ namespace dae
 		float max{ FLT_MAX };
 	};
 
+	//Side planes of a bundle of rays leaving from one origin, a box completely outside one of them is missed by every ray
+	//Zero normals never cull, so a default RayFrustum keeps everything (e.g. shadow rays, which leave from different origins)
+	struct RayFrustum
+	{
+		Vector3 origin{};
+		Vector3 normals[4]{};
+
+		//Planes through consecutive corner directions of the bundle, normals point outwards
+		void Set(const Vector3& _origin, const Vector3 (&corners)[4])
+		{
+			origin = _origin;
+
+			const Vector3 center = corners[0] + corners[1] + corners[2] + corners[3];
+			for (int side = 0; side < 4; ++side)
+			{
+				//A single row or column has no area on that side
+				Vector3 normal = Vector3::Cross(corners[side], corners[(side + 1) % 4]);
+				if (normal.SqrMagnitude() == 0.f)
+				{
+					normals[side] = Vector3{};
+					continue;
+				}
+
+				normal.Normalize();
+				normals[side] = Vector3::Dot(normal, center) > 0.f ? -normal : normal;
+			}
+		}
+
+		//The same planes for rays moved by transform, normals go through the inverse transpose like in ResolveHit
+		RayFrustum Transformed(const Matrix& transform, const Matrix& inverseTransform) const
+		{
+			RayFrustum result{};
+			result.origin = transform.TransformPoint(origin);
+			for (int side = 0; side < 4; ++side)
+			{
+				const Vector3 normal{
+					Vector3::Dot(normals[side], inverseTransform.GetAxisX()),
+					Vector3::Dot(normals[side], inverseTransform.GetAxisY()),
+					Vector3::Dot(normals[side], inverseTransform.GetAxisZ())
+				};
+				result.normals[side] = normal.SqrMagnitude() == 0.f ? Vector3{} : normal.Normalized();
+			}
+			return result;
+		}
+
+		bool IsOutside(const Vector3& minAABB, const Vector3& maxAABB) const
+		{
+			//Slack for boxes the corner rays only graze
+			constexpr float tolerance{ 1e-4f };
+
+			for (const Vector3& normal : normals)
+			{
+				//Corner of the box the farthest inside this plane
+				const Vector3 innerCorner{
+					normal.x > 0.f ? minAABB.x : maxAABB.x,
+					normal.y > 0.f ? minAABB.y : maxAABB.y,
+					normal.z > 0.f ? minAABB.z : maxAABB.z
+				};
+				if (Vector3::Dot(normal, innerCorner - origin) > tolerance)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	//Rays per side of a RayPacket tile, a full tile has exactly one bit per ray in a uint64_t
+	constexpr uint32_t RayPacketWidth{ 8 };
+	constexpr uint32_t RayPacketSize{ RayPacketWidth * RayPacketWidth };
+
+	//Up to RayPacketSize rays traced together, row by row for a screen tile of width x height pixels
+	//Primary rays share an origin and get a frustum, so the acceleration structure is culled once for all of them
+	struct RayPacket
+	{
+		Ray rays[RayPacketSize]{};
+		uint32_t width{};
+		uint32_t height{};
+
+		//Bit i is set when rays[i] takes part, the others are skipped
+		uint64_t activeMask{};
+		RayFrustum frustum{};
+
+		uint32_t GetRayCount() const { return width * height; }
+
+		void SetAllActive()
+		{
+			const uint32_t rayCount = GetRayCount();
+			activeMask = rayCount == RayPacketSize ? ~uint64_t{} : (uint64_t{ 1 } << rayCount) - 1;
+		}
+
+		//Call after filling in the rays of a tile, when they all leave from the same origin
+		void UpdateFrustum()
+		{
+			const Vector3 corners[4]
+			{
+				rays[0].direction,
+				rays[width - 1].direction,
+				rays[width * height - 1].direction,
+				rays[(height - 1) * width].direction
+			};
+			frustum.Set(rays[0].origin, corners);
+		}
+	};
+
+	//Rays per RayBlock, 8 with AVX2 and 4 with SSE like the collapsed BVH nodes
+	constexpr uint32_t RayBlockWidth{ BVHWideWidth };
+	constexpr uint32_t RayPacketBlockCount{ RayPacketSize / RayBlockWidth };
+
+	//Rays in structure-of-arrays form, so one SIMD test covers RayBlockWidth rays against the same node or triangle
+	//Rays i * RayBlockWidth up to (i + 1) * RayBlockWidth of a packet go in block i, unused lanes stay zero
+	struct alignas(32) RayBlock
+	{
+		float originX[RayBlockWidth]{};
+		float originY[RayBlockWidth]{};
+		float originZ[RayBlockWidth]{};
+		float directionX[RayBlockWidth]{};
+		float directionY[RayBlockWidth]{};
+		float directionZ[RayBlockWidth]{};
+		float invDirectionX[RayBlockWidth]{};
+		float invDirectionY[RayBlockWidth]{};
+		float invDirectionZ[RayBlockWidth]{};
+		float min[RayBlockWidth]{};
+		float max[RayBlockWidth]{};
+
+		void SetLane(uint32_t lane, const Ray& ray)
+		{
+			originX[lane] = ray.origin.x;
+			originY[lane] = ray.origin.y;
+			originZ[lane] = ray.origin.z;
+			directionX[lane] = ray.direction.x;
+			directionY[lane] = ray.direction.y;
+			directionZ[lane] = ray.direction.z;
+			invDirectionX[lane] = 1.f / ray.direction.x;
+			invDirectionY[lane] = 1.f / ray.direction.y;
+			invDirectionZ[lane] = 1.f / ray.direction.z;
+			min[lane] = ray.min;
+			max[lane] = ray.max;
+		}
+	};
+
 	struct HitRecord
 	{
 		Vector3 origin{};
@@ -270,5 +979,13 @@ namespace dae
 		bool didHit{ false };
 		unsigned char materialIndex{ 0 };
 	};
+
+	//Closest-hit state without any attributes, the HitRecord only gets built for the final hit (GeometryUtils::ResolveHit)
+	struct HitCandidate
+	{
+		float t = FLT_MAX;
+		uint32_t primitiveIndex{ UINT32_MAX };	//Filled in by the caller, the kernels don't know where the primitive lives
+		uint32_t triangleIndex{ UINT32_MAX };	//Closest triangle of a TriangleMesh
+	};
 #pragma endregion
 }
\ No newline at end of file
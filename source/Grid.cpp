@@ -0,0 +1,137 @@
+#include "Grid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+namespace dae {
+	void Grid::Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		assert(minBounds.size() == maxBounds.size());
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		Clear();
+
+		const uint32_t primitiveCount = static_cast<uint32_t>(minBounds.size());
+		if (primitiveCount == 0)
+		{
+			return;
+		}
+		m_PrimitiveCount = primitiveCount;
+
+		m_MinAABB = { FLT_MAX, FLT_MAX, FLT_MAX };
+		m_MaxAABB = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			if (minBounds[index].x > maxBounds[index].x)
+			{
+				continue;
+			}
+			m_MinAABB = Vector3::Min(m_MinAABB, minBounds[index]);
+			m_MaxAABB = Vector3::Max(m_MaxAABB, maxBounds[index]);
+		}
+
+		//Only empty primitives
+		if (m_MinAABB.x > m_MaxAABB.x)
+		{
+			m_MinAABB = {};
+			m_MaxAABB = {};
+		}
+
+		//Cubic cells with about Density cells per primitive, flat axes get a single cell
+		const Vector3 extent = m_MaxAABB - m_MinAABB;
+		float volume{ 1.f };
+		int dimensions{ 0 };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (extent[axis] > 0.f)
+			{
+				volume *= extent[axis];
+				++dimensions;
+			}
+		}
+		const float cellsPerUnit = dimensions > 0 ? std::pow(Density * primitiveCount / volume, 1.f / dimensions) : 0.f;
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (extent[axis] > 0.f)
+			{
+				m_Resolution[axis] = static_cast<int>(std::clamp(extent[axis] * cellsPerUnit, 1.f, static_cast<float>(MaxResolution)));
+				m_CellSize[axis] = extent[axis] / m_Resolution[axis];
+				m_InvCellSize[axis] = 1.f / m_CellSize[axis];
+			}
+			else
+			{
+				m_Resolution[axis] = 1;
+				m_CellSize[axis] = 0.f;
+				m_InvCellSize[axis] = 0.f;
+			}
+		}
+
+		//Count the primitives per cell, turn the counts into start offsets, then fill the cells
+		const size_t cellCount = static_cast<size_t>(m_Resolution[0]) * m_Resolution[1] * m_Resolution[2];
+		m_CellStarts.assign(cellCount + 1, 0);
+
+		int minCell[3]{}, maxCell[3]{};
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			if (!GetCellRange(minBounds[index], maxBounds[index], minCell, maxCell))
+			{
+				continue;
+			}
+
+			for (int z = minCell[2]; z <= maxCell[2]; ++z)
+				for (int y = minCell[1]; y <= maxCell[1]; ++y)
+					for (int x = minCell[0]; x <= maxCell[0]; ++x)
+						++m_CellStarts[(static_cast<size_t>(z) * m_Resolution[1] + y) * m_Resolution[0] + x + 1];
+		}
+
+		for (size_t cell = 0; cell < cellCount; ++cell)
+		{
+			m_CellStarts[cell + 1] += m_CellStarts[cell];
+		}
+
+		m_CellPrimitives.resize(m_CellStarts[cellCount]);
+		std::vector<uint32_t> cellFill(m_CellStarts.begin(), m_CellStarts.end() - 1);
+
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			if (!GetCellRange(minBounds[index], maxBounds[index], minCell, maxCell))
+			{
+				continue;
+			}
+
+			for (int z = minCell[2]; z <= maxCell[2]; ++z)
+				for (int y = minCell[1]; y <= maxCell[1]; ++y)
+					for (int x = minCell[0]; x <= maxCell[0]; ++x)
+						m_CellPrimitives[cellFill[(static_cast<size_t>(z) * m_Resolution[1] + y) * m_Resolution[0] + x]++] = index;
+		}
+
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+
+	void Grid::Clear()
+	{
+		m_CellStarts.clear();
+		m_CellPrimitives.clear();
+		m_PrimitiveCount = 0;
+	}
+
+	bool Grid::GetCellRange(const Vector3& minAABB, const Vector3& maxAABB, int* minCell, int* maxCell) const
+	{
+		if (minAABB.x > maxAABB.x || minAABB.y > maxAABB.y || minAABB.z > maxAABB.z)
+		{
+			return false;
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minCell[axis] = std::clamp(static_cast<int>((minAABB[axis] - m_MinAABB[axis]) * m_InvCellSize[axis]), 0, m_Resolution[axis] - 1);
+			maxCell[axis] = std::clamp(static_cast<int>((maxAABB[axis] - m_MinAABB[axis]) * m_InvCellSize[axis]), 0, m_Resolution[axis] - 1);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	//Uniform grid over a set of primitive AABBs, traversed with a 3D-DDA
+	//Cells store their primitives in one flat array, cell i owns [cellStarts[i], cellStarts[i + 1])
+	class Grid final
+	{
+	public:
+		static constexpr float Density{ 4.f };				//Cells per primitive
+		static constexpr uint32_t MaxResolution{ 128 };		//Cells per axis
+
+		/**
+		 * \brief Builds the grid, the resolution follows the primitive count and the shape of the bounds
+		 * \param minBounds min corner of the AABB of every primitive
+		 * \param maxBounds max corner of the AABB of every primitive
+		 */
+		void Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		void Clear();
+
+		bool IsEmpty() const { return m_CellStarts.empty(); }
+		uint32_t GetPrimitiveCount() const { return m_PrimitiveCount; }
+
+		const Vector3& GetMinAABB() const { return m_MinAABB; }
+		const Vector3& GetMaxAABB() const { return m_MaxAABB; }
+		const Vector3& GetCellSize() const { return m_CellSize; }
+		const Vector3& GetInvCellSize() const { return m_InvCellSize; }
+		const int* GetResolution() const { return m_Resolution; }
+
+		const std::vector<uint32_t>& GetCellStarts() const { return m_CellStarts; }
+		const std::vector<uint32_t>& GetCellPrimitives() const { return m_CellPrimitives; }
+
+		float GetBuildTime() const { return m_BuildTime; }
+
+	private:
+		std::vector<uint32_t> m_CellStarts{};
+		std::vector<uint32_t> m_CellPrimitives{};
+		uint32_t m_PrimitiveCount{};
+
+		Vector3 m_MinAABB{};
+		Vector3 m_MaxAABB{};
+		Vector3 m_CellSize{};
+		Vector3 m_InvCellSize{};	//0 on flat axes, so every point lands in cell 0 there
+		int m_Resolution[3]{};
+
+		float m_BuildTime{};
+
+		//Inclusive cell range covered by an AABB, false for inverted (empty) bounds
+		bool GetCellRange(const Vector3& minAABB, const Vector3& maxAABB, int* minCell, int* maxCell) const;
+	};
+}
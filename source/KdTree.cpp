@@ -0,0 +1,230 @@
+#include "KdTree.h"
+#include "BVH.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+namespace dae {
+	void KdTree::Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		assert(minBounds.size() == maxBounds.size());
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+
+		Clear();
+
+		const uint32_t primitiveCount = static_cast<uint32_t>(minBounds.size());
+		if (primitiveCount == 0)
+		{
+			return;
+		}
+		m_PrimitiveCount = primitiveCount;
+		m_DepthLimit = std::min(MaxDepth, static_cast<uint32_t>(8.f + 1.3f * std::log2(static_cast<float>(primitiveCount))));
+
+		//Empty (inverted) primitives can never be hit, leave them out
+		std::vector<uint32_t> primitives{};
+		primitives.reserve(primitiveCount);
+
+		m_MinAABB = { FLT_MAX, FLT_MAX, FLT_MAX };
+		m_MaxAABB = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t index = 0; index < primitiveCount; ++index)
+		{
+			if (minBounds[index].x > maxBounds[index].x || minBounds[index].y > maxBounds[index].y || minBounds[index].z > maxBounds[index].z)
+			{
+				continue;
+			}
+			m_MinAABB = Vector3::Min(m_MinAABB, minBounds[index]);
+			m_MaxAABB = Vector3::Max(m_MaxAABB, maxBounds[index]);
+			primitives.push_back(index);
+		}
+
+		if (primitives.empty())
+		{
+			m_MinAABB = {};
+			m_MaxAABB = {};
+		}
+
+		m_Nodes.push_back({});
+		Subdivide(0, 1, primitives, m_MinAABB, m_MaxAABB, minBounds, maxBounds);
+
+		m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+
+	void KdTree::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_PrimitiveCount = 0;
+	}
+
+	void KdTree::MakeLeaf(uint32_t nodeIndex, const std::vector<uint32_t>& primitives)
+	{
+		KdNode& node = m_Nodes[nodeIndex];
+		node.axis = KdNode::LeafAxis;
+		node.leftFirst = static_cast<uint32_t>(m_PrimitiveIndices.size());
+		node.primitiveCount = static_cast<uint32_t>(primitives.size());
+
+		m_PrimitiveIndices.insert(m_PrimitiveIndices.end(), primitives.begin(), primitives.end());
+	}
+
+	void KdTree::Subdivide(uint32_t nodeIndex, uint32_t depth, std::vector<uint32_t>& primitives, const Vector3& voxelMin, const Vector3& voxelMax, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds)
+	{
+		const uint32_t count = static_cast<uint32_t>(primitives.size());
+		const float voxelArea = BVH::SurfaceArea(voxelMin, voxelMax);
+
+		if (count <= 1 || depth >= m_DepthLimit || voxelArea <= 0.f)
+		{
+			MakeLeaf(nodeIndex, primitives);
+			return;
+		}
+
+		//Primitive bounds clipped to the voxel turn into start/end events, flat ones into a single planar event
+		enum class EventType : uint32_t
+		{
+			End,
+			Planar,
+			Start
+		};
+
+		struct Event
+		{
+			float position;
+			EventType type;
+		};
+
+		std::vector<Event> events{};
+		events.reserve(count * 2);
+
+		int bestAxis{ -1 };
+		float bestSplit{};
+		float bestCost{ FLT_MAX };
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			events.clear();
+			for (const uint32_t primitive : primitives)
+			{
+				const float low = std::max(minBounds[primitive][axis], voxelMin[axis]);
+				const float high = std::min(maxBounds[primitive][axis], voxelMax[axis]);
+
+				if (low == high)
+				{
+					events.push_back({ low, EventType::Planar });
+				}
+				else
+				{
+					events.push_back({ low, EventType::Start });
+					events.push_back({ high, EventType::End });
+				}
+			}
+
+			std::sort(events.begin(), events.end(), [](const Event& a, const Event& b)
+				{
+					return a.position < b.position || (a.position == b.position && a.type < b.type);
+				});
+
+			//Sweep the candidate planes, primitives lying in the plane go to the left
+			uint32_t leftCount{ 0 };
+			uint32_t rightCount{ count };
+			for (size_t index = 0; index < events.size();)
+			{
+				const float position = events[index].position;
+
+				uint32_t endCount{}, planarCount{}, startCount{};
+				for (; index < events.size() && events[index].position == position && events[index].type == EventType::End; ++index)
+				{
+					++endCount;
+				}
+				for (; index < events.size() && events[index].position == position && events[index].type == EventType::Planar; ++index)
+				{
+					++planarCount;
+				}
+				for (; index < events.size() && events[index].position == position && events[index].type == EventType::Start; ++index)
+				{
+					++startCount;
+				}
+
+				rightCount -= endCount + planarCount;
+
+				if (position > voxelMin[axis] && position < voxelMax[axis])
+				{
+					Vector3 leftMax{ voxelMax };
+					leftMax[axis] = position;
+					Vector3 rightMin{ voxelMin };
+					rightMin[axis] = position;
+
+					const uint32_t splitLeftCount = leftCount + planarCount;
+					float cost = TraversalCost + IntersectionCost *
+						(BVH::SurfaceArea(voxelMin, leftMax) * splitLeftCount + BVH::SurfaceArea(rightMin, voxelMax) * rightCount) / voxelArea;
+
+					if (splitLeftCount == 0 || rightCount == 0)
+					{
+						cost *= 1.f - EmptyBonus;
+					}
+
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = position;
+					}
+				}
+
+				leftCount += startCount + planarCount;
+			}
+		}
+
+		//Only split when it's cheaper than intersecting every primitive in this voxel
+		if (bestAxis < 0 || bestCost >= IntersectionCost * count)
+		{
+			MakeLeaf(nodeIndex, primitives);
+			return;
+		}
+
+		std::vector<uint32_t> leftPrimitives{};
+		std::vector<uint32_t> rightPrimitives{};
+		for (const uint32_t primitive : primitives)
+		{
+			const float low = std::max(minBounds[primitive][bestAxis], voxelMin[bestAxis]);
+			const float high = std::min(maxBounds[primitive][bestAxis], voxelMax[bestAxis]);
+
+			if (low == high && low == bestSplit)
+			{
+				leftPrimitives.push_back(primitive);
+				continue;
+			}
+			if (low < bestSplit)
+			{
+				leftPrimitives.push_back(primitive);
+			}
+			if (high > bestSplit)
+			{
+				rightPrimitives.push_back(primitive);
+			}
+		}
+
+		primitives.clear();
+		primitives.shrink_to_fit();
+
+		const uint32_t leftIndex = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes.push_back({});
+		m_Nodes.push_back({});
+
+		KdNode& node = m_Nodes[nodeIndex];
+		node.axis = static_cast<uint32_t>(bestAxis);
+		node.split = bestSplit;
+		node.leftFirst = leftIndex;
+		node.primitiveCount = 0;
+
+		Vector3 leftMax{ voxelMax };
+		leftMax[bestAxis] = bestSplit;
+		Vector3 rightMin{ voxelMin };
+		rightMin[bestAxis] = bestSplit;
+
+		Subdivide(leftIndex, depth + 1, leftPrimitives, voxelMin, leftMax, minBounds, maxBounds);
+		Subdivide(leftIndex + 1, depth + 1, rightPrimitives, rightMin, voxelMax, minBounds, maxBounds);
+	}
+}
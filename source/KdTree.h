@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	struct KdNode
+	{
+		static constexpr uint32_t LeafAxis{ 3 };
+
+		float split{};				//Inner node: position of the split plane
+		uint32_t leftFirst{};		//Inner node: index of the left child (right child is leftFirst + 1), Leaf: first primitive
+		uint32_t primitiveCount{};
+		uint32_t axis{ LeafAxis };
+
+		bool IsLeaf() const { return axis == LeafAxis; }
+	};
+
+	//SAH kd-tree over a set of primitive AABBs
+	//Primitives straddling a split plane are referenced by both children, the root is always node 0
+	class KdTree final
+	{
+	public:
+		static constexpr uint32_t MaxDepth{ 40 };	//Builds stop at min(MaxDepth, 8 + 1.3 * log2(primitive count))
+
+		//SAH costs, the empty space bonus favours splits that cut off empty space
+		static constexpr float TraversalCost{ 1.f };
+		static constexpr float IntersectionCost{ 1.5f };
+		static constexpr float EmptyBonus{ 0.2f };
+
+		/**
+		 * \brief Builds the tree with a full SAH sweep over the primitive bounds clipped to every node
+		 * \param minBounds min corner of the AABB of every primitive
+		 * \param maxBounds max corner of the AABB of every primitive
+		 */
+		void Build(const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		void Clear();
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		const std::vector<KdNode>& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+		uint32_t GetPrimitiveCount() const { return m_PrimitiveCount; }
+
+		const Vector3& GetMinAABB() const { return m_MinAABB; }
+		const Vector3& GetMaxAABB() const { return m_MaxAABB; }
+
+		float GetBuildTime() const { return m_BuildTime; }
+
+	private:
+		std::vector<KdNode> m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+		uint32_t m_PrimitiveCount{};
+		uint32_t m_DepthLimit{};
+
+		Vector3 m_MinAABB{};
+		Vector3 m_MaxAABB{};
+
+		float m_BuildTime{};
+
+		void Subdivide(uint32_t nodeIndex, uint32_t depth, std::vector<uint32_t>& primitives, const Vector3& voxelMin, const Vector3& voxelMax, const std::vector<Vector3>& minBounds, const std::vector<Vector3>& maxBounds);
+		void MakeLeaf(uint32_t nodeIndex, const std::vector<uint32_t>& primitives);
+	};
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 
 namespace dae
 {
@@ -27,4 +28,16 @@ namespace dae
 	{
 		return abs(a - b) < epsilon;
 	}
+
+	//Spreads the lower 21 bits of value so every bit is followed by two zero bits, three of them interleave into a 63-bit Morton code
+	inline uint64_t ExpandBits(uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | value << 32) & 0x1f00000000ffff;
+		value = (value | value << 16) & 0x1f0000ff0000ff;
+		value = (value | value << 8) & 0x100f00f00f00f00f;
+		value = (value | value << 4) & 0x10c30c30c30c30c3;
+		value = (value | value << 2) & 0x1249249249249249;
+		return value;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "Vector3.h"
+#include "Vector4.h"
+#include "Matrix.h"
+
+//Only the SSE backend has something to compare against
+#if defined(DAE_SIMD_MATH)
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace dae
+{
+	namespace SIMD
+	{
+		//Bit patterns, so a zero of the other sign is a mismatch too
+		static bool IsSame(float a, float b)
+		{
+			return std::memcmp(&a, &b, sizeof(float)) == 0;
+		}
+
+		static bool IsSame(const Vector3& a, float x, float y, float z)
+		{
+			return IsSame(a.x, x) && IsSame(a.y, y) && IsSame(a.z, z);
+		}
+
+		static bool IsSame(const Vector4& a, float x, float y, float z, float w)
+		{
+			return IsSame(a.x, x) && IsSame(a.y, y) && IsSame(a.z, z) && IsSame(a.w, w);
+		}
+
+		bool MatchesScalarBackend(uint32_t sampleCount)
+		{
+			std::mt19937 generator{ 1 };
+			std::uniform_real_distribution<float> distribution{ -10.f, 10.f };
+			const auto random = [&]() { return distribution(generator); };
+
+			bool matches{ true };
+			const auto check = [&](const char* operation, bool isSame)
+				{
+					if (!isSame && matches)
+					{
+						std::cout << "SIMD math differs from the scalar backend in " << operation << '\n';
+					}
+					matches = matches && isSame;
+				};
+
+			for (uint32_t sample = 0; sample < sampleCount; ++sample)
+			{
+				Vector3 a{ random(), random(), random() };
+				Vector3 b{ random(), random(), random() };
+
+				//Axis aligned inputs give exact zeros, where the order of the operations decides their sign
+				if (sample % 8 == 0)
+				{
+					a = { a.x, 0.f, 0.f };
+					b = { 0.f, b.y, 0.f };
+				}
+				const float s = random();
+
+				//Scalar formulas of Vector3.cpp
+				const float aLength = sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+				check("Vector3(from, to)", IsSame(Vector3{ a, b }, b.x - a.x, b.y - a.y, b.z - a.z));
+				check("Vector3::Magnitude", IsSame(a.Magnitude(), aLength));
+				check("Vector3::SqrMagnitude", IsSame(a.SqrMagnitude(), a.x * a.x + a.y * a.y + a.z * a.z));
+				check("Vector3::Normalized", IsSame(a.Normalized(), a.x / aLength, a.y / aLength, a.z / aLength));
+				Vector3 normalized{ a };
+				check("Vector3::Normalize", IsSame(normalized.Normalize(), aLength) && IsSame(normalized, a.x / aLength, a.y / aLength, a.z / aLength));
+				check("Vector3::Dot", IsSame(Vector3::Dot(a, b), (a.x * b.x) + (a.y * b.y) + (a.z * b.z)));
+				check("Vector3::Cross", IsSame(Vector3::Cross(a, b), a.y * b.z - b.y * a.z, -(a.x * b.z - b.x * a.z), a.x * b.y - b.x * a.y));
+				check("Vector3::Max", IsSame(Vector3::Max(a, b), std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)));
+				check("Vector3::Min", IsSame(Vector3::Min(a, b), std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)));
+				check("Vector3::operator*", IsSame(a * s, a.x * s, a.y * s, a.z * s));
+				check("Vector3::operator/", IsSame(a / s, a.x / s, a.y / s, a.z / s));
+				check("Vector3::operator+", IsSame(a + b, a.x + b.x, a.y + b.y, a.z + b.z));
+				check("Vector3::operator-", IsSame(a - b, a.x - b.x, a.y - b.y, a.z - b.z));
+				check("Vector3::operator-()", IsSame(-a, -a.x, -a.y, -a.z));
+
+				//Scalar formulas of Vector4.cpp
+				const Vector4 c{ a, random() };
+				const Vector4 d{ b, random() };
+				const float cLength = sqrtf(c.x * c.x + c.y * c.y + c.z * c.z + c.w * c.w);
+				check("Vector4::Magnitude", IsSame(c.Magnitude(), cLength));
+				check("Vector4::Normalized", IsSame(c.Normalized(), c.x / cLength, c.y / cLength, c.z / cLength, c.w / cLength));
+				check("Vector4::Dot", IsSame(Vector4::Dot(c, d), (c.x * d.x) + (c.y * d.y) + (c.z * d.z) + (c.w * d.w)));
+				check("Vector4::operator*", IsSame(c * s, c.x * s, c.y * s, c.z * s, c.w * s));
+				check("Vector4::operator+", IsSame(c + d, c.x + d.x, c.y + d.y, c.z + d.z, c.w + d.w));
+				check("Vector4::operator-", IsSame(c - d, c.x - d.x, c.y - d.y, c.z - d.z, c.w - d.w));
+
+				//Scalar formulas of Matrix.cpp
+				const Matrix m = Matrix::CreateRotation(a) * Matrix::CreateScale(random(), random(), random()) * Matrix::CreateTranslation(b);
+				const Matrix n = Matrix::CreateRotation(b) * Matrix::CreateTranslation(a);
+				check("Matrix::TransformVector", IsSame(m.TransformVector(a),
+					m[0].x * a.x + m[1].x * a.y + m[2].x * a.z,
+					m[0].y * a.x + m[1].y * a.y + m[2].y * a.z,
+					m[0].z * a.x + m[1].z * a.y + m[2].z * a.z));
+				check("Matrix::TransformPoint", IsSame(m.TransformPoint(a),
+					m[0].x * a.x + m[1].x * a.y + m[2].x * a.z + m[3].x,
+					m[0].y * a.x + m[1].y * a.y + m[2].y * a.z + m[3].y,
+					m[0].z * a.x + m[1].z * a.y + m[2].z * a.z + m[3].z));
+
+				//The range versions transform 4 at a time plus a remainder
+				Vector3 points[5]{ a, b, -a, a + b, a - b };
+				Vector3 transformed[5]{};
+				m.TransformPoints(points, transformed, 5);
+				for (int index{ 0 }; index < 5; ++index)
+				{
+					const Vector3& p = points[index];
+					check("Matrix::TransformPoints", IsSame(transformed[index],
+						m[0].x * p.x + m[1].x * p.y + m[2].x * p.z + m[3].x,
+						m[0].y * p.x + m[1].y * p.y + m[2].y * p.z + m[3].y,
+						m[0].z * p.x + m[1].z * p.y + m[2].z * p.z + m[3].z));
+				}
+				m.TransformVectors(points, transformed, 5);
+				for (int index{ 0 }; index < 5; ++index)
+				{
+					const Vector3& p = points[index];
+					check("Matrix::TransformVectors", IsSame(transformed[index],
+						m[0].x * p.x + m[1].x * p.y + m[2].x * p.z,
+						m[0].y * p.x + m[1].y * p.y + m[2].y * p.z,
+						m[0].z * p.x + m[1].z * p.y + m[2].z * p.z));
+				}
+
+				const Matrix transposed = Matrix::Transpose(m);
+				const Matrix product = m * n;
+				for (int r{ 0 }; r < 4; ++r)
+				{
+					check("Matrix::Transpose", IsSame(transposed[r], m[0][r], m[1][r], m[2][r], m[3][r]));
+
+					//Row r of m dotted with every column of n
+					float row[4]{};
+					for (int column{ 0 }; column < 4; ++column)
+					{
+						row[column] = (m[r].x * n[0][column]) + (m[r].y * n[1][column]) + (m[r].z * n[2][column]) + (m[r].w * n[3][column]);
+					}
+					check("Matrix::operator*", IsSame(product[r], row[0], row[1], row[2], row[3]));
+				}
+			}
+
+			return matches;
+		}
+	}
+}
+#endif
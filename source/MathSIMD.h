@@ -0,0 +1,266 @@
+#pragma once
+//SSE backend for Vector3 and Vector4 (MatrixSIMD.h for Matrix), only used when DAE_SIMD_MATH is defined (see Vector3.h)
+//Everything the renderer calls per ray is defined inline here instead of in the .cpp files, the rest stays out-of-line
+//Every lane does the same operations in the same order as the scalar backend, so both give bit-identical results
+//(signed zeros included), SIMD::MatchesScalarBackend in MathSIMD.cpp checks that on random inputs
+#include <immintrin.h>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+#include "Vector3.h"
+#include "Vector4.h"
+
+namespace dae
+{
+	namespace SIMD
+	{
+		//x and y in one 8 byte load and z on its own, so it never reads past the 12 bytes of the vector. The w lane is 0
+		//Goes through __m64 like ToVector3, reading the floats as a double breaks strict aliasing and lets the compiler move the load before their stores
+		inline __m128 Load(const Vector3& v)
+		{
+			const __m128 xy = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(&v.x));
+			return _mm_movelh_ps(xy, _mm_load_ss(&v.z));
+		}
+
+		inline Vector3 ToVector3(__m128 v)
+		{
+			Vector3 result;
+			_mm_storel_pi(reinterpret_cast<__m64*>(&result.x), v);
+			_mm_store_ss(&result.z, _mm_movehl_ps(v, v));
+			return result;
+		}
+
+		inline __m128 Load(const Vector4& v)
+		{
+			return _mm_load_ps(&v.x);
+		}
+
+		inline Vector4 ToVector4(__m128 v)
+		{
+			Vector4 result;
+			_mm_store_ps(&result.x, v);
+			return result;
+		}
+
+		//x * x + y * y + z * z, summed left to right like the scalar Dot
+		inline __m128 Dot3(__m128 v1, __m128 v2)
+		{
+			const __m128 product = _mm_mul_ps(v1, v2);
+			const __m128 xy = _mm_add_ss(product, _mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1)));
+			return _mm_add_ss(xy, _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 2, 2, 2)));
+		}
+
+		//Runs the operations of this backend and MatrixSIMD.h on random inputs against the scalar formulas,
+		//compares the bit patterns and prints the first operation that differs
+		bool MatchesScalarBackend(uint32_t sampleCount = 1000);
+	}
+
+#pragma region Vector3
+	inline Vector3::Vector3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+
+	inline Vector3::Vector3(const Vector4& v) : x(v.x), y(v.y), z(v.z) {}
+
+	inline Vector3::Vector3(const Vector3& from, const Vector3& to)
+	{
+		*this = SIMD::ToVector3(_mm_sub_ps(SIMD::Load(to), SIMD::Load(from)));
+	}
+
+	inline float Vector3::Magnitude() const
+	{
+		const __m128 v = SIMD::Load(*this);
+		return _mm_cvtss_f32(_mm_sqrt_ss(SIMD::Dot3(v, v)));
+	}
+
+	inline float Vector3::SqrMagnitude() const
+	{
+		const __m128 v = SIMD::Load(*this);
+		return _mm_cvtss_f32(SIMD::Dot3(v, v));
+	}
+
+	inline float Vector3::Normalize()
+	{
+		const float m = Magnitude();
+		*this = SIMD::ToVector3(_mm_div_ps(SIMD::Load(*this), _mm_set1_ps(m)));
+		return m;
+	}
+
+	inline Vector3 Vector3::Normalized() const
+	{
+		return SIMD::ToVector3(_mm_div_ps(SIMD::Load(*this), _mm_set1_ps(Magnitude())));
+	}
+
+	inline float Vector3::Dot(const Vector3& v1, const Vector3& v2)
+	{
+		return _mm_cvtss_f32(SIMD::Dot3(SIMD::Load(v1), SIMD::Load(v2)));
+	}
+
+	inline Vector3 Vector3::Cross(const Vector3& v1, const Vector3& v2)
+	{
+		//v1.yxx * v2.zzy - v2.yxx * v1.zzy with the y lane negated afterwards, like the scalar backend
+		//(negating the difference instead of swapping its terms keeps the sign of a zero y)
+		const __m128 a = SIMD::Load(v1);
+		const __m128 b = SIMD::Load(v2);
+		const __m128 aYXX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 0, 1));
+		const __m128 bYXX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 0, 1));
+		const __m128 aZZY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 2, 2));
+		const __m128 bZZY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 2, 2));
+		const __m128 difference = _mm_sub_ps(_mm_mul_ps(aYXX, bZZY), _mm_mul_ps(bYXX, aZZY));
+		return SIMD::ToVector3(_mm_xor_ps(difference, _mm_set_ps(0.f, 0.f, -0.f, 0.f)));
+	}
+
+	//Operands swapped so ties and NaNs resolve like std::max and std::min
+	inline Vector3 Vector3::Max(const Vector3& v1, const Vector3& v2)
+	{
+		return SIMD::ToVector3(_mm_max_ps(SIMD::Load(v2), SIMD::Load(v1)));
+	}
+
+	inline Vector3 Vector3::Min(const Vector3& v1, const Vector3& v2)
+	{
+		return SIMD::ToVector3(_mm_min_ps(SIMD::Load(v2), SIMD::Load(v1)));
+	}
+
+	inline Vector3 Vector3::operator*(float scale) const
+	{
+		return SIMD::ToVector3(_mm_mul_ps(SIMD::Load(*this), _mm_set1_ps(scale)));
+	}
+
+	inline Vector3 Vector3::operator/(float scale) const
+	{
+		return SIMD::ToVector3(_mm_div_ps(SIMD::Load(*this), _mm_set1_ps(scale)));
+	}
+
+	inline Vector3 Vector3::operator+(const Vector3& v) const
+	{
+		return SIMD::ToVector3(_mm_add_ps(SIMD::Load(*this), SIMD::Load(v)));
+	}
+
+	inline Vector3 Vector3::operator-(const Vector3& v) const
+	{
+		return SIMD::ToVector3(_mm_sub_ps(SIMD::Load(*this), SIMD::Load(v)));
+	}
+
+	inline Vector3 Vector3::operator-() const
+	{
+		return SIMD::ToVector3(_mm_xor_ps(SIMD::Load(*this), _mm_set1_ps(-0.f)));
+	}
+
+	inline Vector3& Vector3::operator*=(float scale)
+	{
+		*this = *this * scale;
+		return *this;
+	}
+
+	inline Vector3& Vector3::operator/=(float scale)
+	{
+		*this = *this / scale;
+		return *this;
+	}
+
+	inline Vector3& Vector3::operator-=(const Vector3& v)
+	{
+		*this = *this - v;
+		return *this;
+	}
+
+	inline Vector3& Vector3::operator+=(const Vector3& v)
+	{
+		*this = *this + v;
+		return *this;
+	}
+
+	inline float& Vector3::operator[](int index)
+	{
+		assert(index <= 2 && index >= 0);
+
+		if (index == 0) return x;
+		if (index == 1) return y;
+		return z;
+	}
+
+	inline float Vector3::operator[](int index) const
+	{
+		assert(index <= 2 && index >= 0);
+
+		if (index == 0) return x;
+		if (index == 1) return y;
+		return z;
+	}
+#pragma endregion
+
+#pragma region Vector4
+	inline Vector4::Vector4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+	inline Vector4::Vector4(const Vector3& v, float _w) : x(v.x), y(v.y), z(v.z), w(_w) {}
+
+	inline float Vector4::Magnitude() const
+	{
+		return sqrtf(Dot(*this, *this));
+	}
+
+	inline float Vector4::SqrMagnitude() const
+	{
+		return Dot(*this, *this);
+	}
+
+	inline float Vector4::Normalize()
+	{
+		const float m = Magnitude();
+		*this = SIMD::ToVector4(_mm_div_ps(SIMD::Load(*this), _mm_set1_ps(m)));
+		return m;
+	}
+
+	inline Vector4 Vector4::Normalized() const
+	{
+		return SIMD::ToVector4(_mm_div_ps(SIMD::Load(*this), _mm_set1_ps(Magnitude())));
+	}
+
+	inline float Vector4::Dot(const Vector4& v1, const Vector4& v2)
+	{
+		const __m128 product = _mm_mul_ps(SIMD::Load(v1), SIMD::Load(v2));
+		__m128 sum = _mm_add_ss(product, _mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1)));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 2, 2, 2)));
+		return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(product, product, _MM_SHUFFLE(3, 3, 3, 3))));
+	}
+
+	inline Vector4 Vector4::operator*(float scale) const
+	{
+		return SIMD::ToVector4(_mm_mul_ps(SIMD::Load(*this), _mm_set1_ps(scale)));
+	}
+
+	inline Vector4 Vector4::operator+(const Vector4& v) const
+	{
+		return SIMD::ToVector4(_mm_add_ps(SIMD::Load(*this), SIMD::Load(v)));
+	}
+
+	inline Vector4 Vector4::operator-(const Vector4& v) const
+	{
+		return SIMD::ToVector4(_mm_sub_ps(SIMD::Load(*this), SIMD::Load(v)));
+	}
+
+	inline Vector4& Vector4::operator+=(const Vector4& v)
+	{
+		*this = *this + v;
+		return *this;
+	}
+
+	inline float& Vector4::operator[](int index)
+	{
+		assert(index <= 3 && index >= 0);
+
+		if (index == 0) return x;
+		if (index == 1) return y;
+		if (index == 2) return z;
+		return w;
+	}
+
+	inline float Vector4::operator[](int index) const
+	{
+		assert(index <= 3 && index >= 0);
+
+		if (index == 0) return x;
+		if (index == 1) return y;
+		if (index == 2) return z;
+		return w;
+	}
+#pragma endregion
+}
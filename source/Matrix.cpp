@@ -1,11 +1,50 @@
 #include "Matrix.h"
 
+#include <algorithm>
 #include <cassert>
+#include <future>
+#include <thread>
+#include <vector>
 
 #include "MathHelpers.h"
 #include <cmath>
 
 namespace dae {
+	namespace
+	{
+		//Below this many elements the tasks cost more than the transform itself
+		constexpr size_t ParallelTransformCount{ 1 << 16 };
+
+		//Calls function(first, count) on consecutive chunks, spread over the cores for large arrays
+		template<typename Function>
+		void ForEachChunk(size_t count, Function function)
+		{
+			const size_t numTasks{ count < ParallelTransformCount ? 1 : std::max(std::thread::hardware_concurrency(), 1u) };
+			if (numTasks == 1)
+			{
+				function(size_t{ 0 }, count);
+				return;
+			}
+
+			//Chunks stay a multiple of 4 so the SIMD backend only hits a remainder in the last one
+			const size_t chunkSize{ ((count + numTasks - 1) / numTasks + 3) & ~size_t{ 3 } };
+
+			std::vector<std::future<void>> tasks{};
+			for (size_t first{ chunkSize }; first < count; first += chunkSize)
+			{
+				tasks.push_back(std::async(std::launch::async, function, first, std::min(chunkSize, count - first)));
+			}
+			function(size_t{ 0 }, std::min(chunkSize, count));
+
+			for (const std::future<void>& task : tasks)
+			{
+				task.wait();
+			}
+		}
+	}
+
+	//Scalar backend, MathSIMD.h defines these inline when DAE_SIMD_MATH is set
+#if !defined(DAE_SIMD_MATH)
 	Matrix::Matrix(const Vector3& xAxis, const Vector3& yAxis, const Vector3& zAxis, const Vector3& t) :
 		Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
 	{
@@ -55,6 +94,22 @@ namespace dae {
 		};
 	}
 
+	void Matrix::TransformVectorRange(const Vector3* pVectors, Vector3* pOut, size_t count) const
+	{
+		for (size_t index{ 0 }; index < count; ++index)
+		{
+			pOut[index] = TransformVector(pVectors[index]);
+		}
+	}
+
+	void Matrix::TransformPointRange(const Vector3* pPoints, Vector3* pOut, size_t count) const
+	{
+		for (size_t index{ 0 }; index < count; ++index)
+		{
+			pOut[index] = TransformPoint(pPoints[index]);
+		}
+	}
+
 	const Matrix& Matrix::Transpose()
 	{
 		Matrix result{};
@@ -74,6 +129,24 @@ namespace dae {
 		return *this;
 	}
 
+#endif
+
+	void Matrix::TransformVectors(const Vector3* pVectors, Vector3* pOut, size_t count) const
+	{
+		ForEachChunk(count, [=, this](size_t first, size_t chunkCount)
+			{
+				TransformVectorRange(pVectors + first, pOut + first, chunkCount);
+			});
+	}
+
+	void Matrix::TransformPoints(const Vector3* pPoints, Vector3* pOut, size_t count) const
+	{
+		ForEachChunk(count, [=, this](size_t first, size_t chunkCount)
+			{
+				TransformPointRange(pPoints + first, pOut + first, chunkCount);
+			});
+	}
+
 	Matrix Matrix::Transpose(const Matrix& m)
 	{
 		Matrix out{ m };
@@ -82,6 +155,45 @@ namespace dae {
 		return out;
 	}
 
+	const Matrix& Matrix::Inverse()
+	{
+		//Affine inverse: invert the 3x3 rotation/scale part (adjugate / determinant), then bring the translation back
+		const Vector3 x = data[0];
+		const Vector3 y = data[1];
+		const Vector3 z = data[2];
+		const Vector3 t = data[3];
+
+		const Vector3 cofactorX = Vector3::Cross(y, z);
+		const Vector3 cofactorY = Vector3::Cross(z, x);
+		const Vector3 cofactorZ = Vector3::Cross(x, y);
+
+		const float determinant = Vector3::Dot(x, cofactorX);
+		assert(determinant != 0.f && "Matrix is not invertible");
+		const float invDeterminant = 1.f / determinant;
+
+		const Vector3 invX{ cofactorX.x * invDeterminant, cofactorY.x * invDeterminant, cofactorZ.x * invDeterminant };
+		const Vector3 invY{ cofactorX.y * invDeterminant, cofactorY.y * invDeterminant, cofactorZ.y * invDeterminant };
+		const Vector3 invZ{ cofactorX.z * invDeterminant, cofactorY.z * invDeterminant, cofactorZ.z * invDeterminant };
+
+		const Vector3 invT = -(t.x * invX + t.y * invY + t.z * invZ);
+
+		data[0] = { invX, 0 };
+		data[1] = { invY, 0 };
+		data[2] = { invZ, 0 };
+		data[3] = { invT, 1 };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
+#if !defined(DAE_SIMD_MATH)
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
@@ -102,6 +214,8 @@ namespace dae {
 		return data[3];
 	}
 
+#endif
+
 	Matrix Matrix::CreateTranslation(float x, float y, float z)
 	{
 		return CreateTranslation({ x, y, z });
@@ -178,6 +292,7 @@ namespace dae {
 		return CreateScale(s[0], s[1], s[2]);
 	}
 
+#if !defined(DAE_SIMD_MATH)
 #pragma region Operator Overloads
 	Vector4& Matrix::operator[](int index)
 	{
@@ -223,4 +338,5 @@ namespace dae {
 		return *this;
 	}
 #pragma endregion
+#endif
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #pragma once
+#include <cstddef>
+
 #include "Vector3.h"
 #include "Vector4.h"
 
@@ -24,7 +26,12 @@ namespace dae {
 		Vector3 TransformVector(float x, float y, float z) const;
 		Vector3 TransformPoint(const Vector3& p) const;
 		Vector3 TransformPoint(float x, float y, float z) const;
+		//Whole arrays at once into preallocated storage (pOut holds count elements, may be the same array as the input)
+		//Large arrays are split over the cores
+		void TransformVectors(const Vector3* pVectors, Vector3* pOut, size_t count) const;
+		void TransformPoints(const Vector3* pPoints, Vector3* pOut, size_t count) const;
 		const Matrix& Transpose();
+		const Matrix& Inverse();
 
 		Vector3 GetAxisX() const;
 		Vector3 GetAxisY() const;
@@ -41,6 +48,7 @@ namespace dae {
 		static Matrix CreateScale(float sx, float sy, float sz);
 		static Matrix CreateScale(const Vector3& s);
 		static Matrix Transpose(const Matrix& m);
+		static Matrix Inverse(const Matrix& m);
 
 		Vector4& operator[](int index);
 		Vector4 operator[](int index) const;
@@ -48,6 +56,9 @@ namespace dae {
 		const Matrix& operator*=(const Matrix& m);
 
 	private:
+		//Single threaded part of TransformVectors/TransformPoints, defined by the active math backend
+		void TransformVectorRange(const Vector3* pVectors, Vector3* pOut, size_t count) const;
+		void TransformPointRange(const Vector3* pPoints, Vector3* pOut, size_t count) const;
 
 		//Row-Major Matrix
 		Vector4 data[4]
@@ -63,4 +74,8 @@ namespace dae {
 		// v2x v2y v2z v2w
 		// v3x v3y v3z v3w
 	};
-}
\ No newline at end of file
+}
+
+#if defined(DAE_SIMD_MATH)
+#include "MatrixSIMD.h"
+#endif
@@ -0,0 +1,205 @@
+#pragma once
+//SSE backend for Matrix, only used when DAE_SIMD_MATH is defined (see Vector3.h and MathSIMD.h)
+#include <algorithm>
+
+#include "MathSIMD.h"
+#include "Matrix.h"
+
+namespace dae
+{
+	namespace SIMD
+	{
+		//Four elements per iteration: transposed into x, y and z registers so every lane does the scalar sums with broadcast matrix components
+		template<bool IsPoint>
+		inline void TransformArray(const Vector4* pRows, const Vector3* pIn, Vector3* pOut, size_t count)
+		{
+			__m128 rows[4][3];
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				rows[r][0] = _mm_set1_ps(pRows[r].x);
+				rows[r][1] = _mm_set1_ps(pRows[r].y);
+				rows[r][2] = _mm_set1_ps(pRows[r].z);
+			}
+
+			const auto transformFour = [&rows](const Vector3* pFourIn, Vector3* pFourOut)
+				{
+					__m128 x = Load(pFourIn[0]);
+					__m128 y = Load(pFourIn[1]);
+					__m128 z = Load(pFourIn[2]);
+					__m128 w = Load(pFourIn[3]);
+					_MM_TRANSPOSE4_PS(x, y, z, w);
+
+					__m128 result[4];
+					for (int c{ 0 }; c < 3; ++c)
+					{
+						result[c] = _mm_mul_ps(rows[0][c], x);
+						result[c] = _mm_add_ps(result[c], _mm_mul_ps(rows[1][c], y));
+						result[c] = _mm_add_ps(result[c], _mm_mul_ps(rows[2][c], z));
+						if constexpr (IsPoint)
+						{
+							result[c] = _mm_add_ps(result[c], rows[3][c]);
+						}
+					}
+					result[3] = _mm_setzero_ps();
+					_MM_TRANSPOSE4_PS(result[0], result[1], result[2], result[3]);
+
+					pFourOut[0] = ToVector3(result[0]);
+					pFourOut[1] = ToVector3(result[1]);
+					pFourOut[2] = ToVector3(result[2]);
+					pFourOut[3] = ToVector3(result[3]);
+				};
+
+			size_t index{ 0 };
+			for (; index + 4 <= count; index += 4)
+			{
+				transformFour(pIn + index, pOut + index);
+			}
+
+			//Remainder goes through a padded copy
+			if (index < count)
+			{
+				Vector3 in[4]{};
+				Vector3 out[4]{};
+				std::copy(pIn + index, pIn + count, in);
+				transformFour(in, out);
+				std::copy(out, out + (count - index), pOut + index);
+			}
+		}
+	}
+
+#pragma region Matrix
+	inline Matrix::Matrix(const Vector3& xAxis, const Vector3& yAxis, const Vector3& zAxis, const Vector3& t) :
+		Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
+	{
+	}
+
+	inline Matrix::Matrix(const Vector4& xAxis, const Vector4& yAxis, const Vector4& zAxis, const Vector4& t)
+	{
+		data[0] = xAxis;
+		data[1] = yAxis;
+		data[2] = zAxis;
+		data[3] = t;
+	}
+
+	inline Matrix::Matrix(const Matrix& m)
+	{
+		data[0] = m.data[0];
+		data[1] = m.data[1];
+		data[2] = m.data[2];
+		data[3] = m.data[3];
+	}
+
+	inline Vector3 Matrix::TransformVector(const Vector3& v) const
+	{
+		return TransformVector(v.x, v.y, v.z);
+	}
+
+	//Rows scaled by the components and summed in the same order as the scalar backend
+	inline Vector3 Matrix::TransformVector(float x, float y, float z) const
+	{
+		__m128 result = _mm_mul_ps(SIMD::Load(data[0]), _mm_set1_ps(x));
+		result = _mm_add_ps(result, _mm_mul_ps(SIMD::Load(data[1]), _mm_set1_ps(y)));
+		result = _mm_add_ps(result, _mm_mul_ps(SIMD::Load(data[2]), _mm_set1_ps(z)));
+		return SIMD::ToVector3(result);
+	}
+
+	inline Vector3 Matrix::TransformPoint(const Vector3& p) const
+	{
+		return TransformPoint(p.x, p.y, p.z);
+	}
+
+	inline Vector3 Matrix::TransformPoint(float x, float y, float z) const
+	{
+		__m128 result = _mm_mul_ps(SIMD::Load(data[0]), _mm_set1_ps(x));
+		result = _mm_add_ps(result, _mm_mul_ps(SIMD::Load(data[1]), _mm_set1_ps(y)));
+		result = _mm_add_ps(result, _mm_mul_ps(SIMD::Load(data[2]), _mm_set1_ps(z)));
+		result = _mm_add_ps(result, SIMD::Load(data[3]));
+		return SIMD::ToVector3(result);
+	}
+
+	inline void Matrix::TransformVectorRange(const Vector3* pVectors, Vector3* pOut, size_t count) const
+	{
+		SIMD::TransformArray<false>(data, pVectors, pOut, count);
+	}
+
+	inline void Matrix::TransformPointRange(const Vector3* pPoints, Vector3* pOut, size_t count) const
+	{
+		SIMD::TransformArray<true>(data, pPoints, pOut, count);
+	}
+
+	inline const Matrix& Matrix::Transpose()
+	{
+		__m128 row0 = SIMD::Load(data[0]);
+		__m128 row1 = SIMD::Load(data[1]);
+		__m128 row2 = SIMD::Load(data[2]);
+		__m128 row3 = SIMD::Load(data[3]);
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+		_mm_store_ps(&data[0].x, row0);
+		_mm_store_ps(&data[1].x, row1);
+		_mm_store_ps(&data[2].x, row2);
+		_mm_store_ps(&data[3].x, row3);
+
+		return *this;
+	}
+
+	inline Vector3 Matrix::GetAxisX() const
+	{
+		return data[0];
+	}
+
+	inline Vector3 Matrix::GetAxisY() const
+	{
+		return data[1];
+	}
+
+	inline Vector3 Matrix::GetAxisZ() const
+	{
+		return data[2];
+	}
+
+	inline Vector3 Matrix::GetTranslation() const
+	{
+		return data[3];
+	}
+
+	inline Vector4& Matrix::operator[](int index)
+	{
+		assert(index <= 3 && index >= 0);
+		return data[index];
+	}
+
+	inline Vector4 Matrix::operator[](int index) const
+	{
+		assert(index <= 3 && index >= 0);
+		return data[index];
+	}
+
+	//Every result row is a combination of the rows of m, weighted by the matching row of this matrix
+	inline Matrix Matrix::operator*(const Matrix& m) const
+	{
+		Matrix result{ *this };
+		result *= m;
+
+		return result;
+	}
+
+	inline const Matrix& Matrix::operator*=(const Matrix& m)
+	{
+		const __m128 row0 = SIMD::Load(m.data[0]);
+		const __m128 row1 = SIMD::Load(m.data[1]);
+		const __m128 row2 = SIMD::Load(m.data[2]);
+		const __m128 row3 = SIMD::Load(m.data[3]);
+
+		for (Vector4& row : data)
+		{
+			__m128 result = _mm_mul_ps(_mm_set1_ps(row.x), row0);
+			result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(row.y), row1));
+			result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(row.z), row2));
+			result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(row.w), row3));
+			_mm_store_ps(&row.x, result);
+		}
+
+		return *this;
+	}
+#pragma endregion
+}
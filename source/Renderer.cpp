@@ -10,6 +10,8 @@
 #include "Scene.h"
 #include "Utils.h"
 
+#include <bit>
+#include <chrono>
 #include <thread>
 #include <future> //ASYNC stuff
 #include <ppl.h>
@@ -19,6 +21,102 @@ using namespace dae;
 #define ASYNC
 //#define PARALLEL_FOR
 
+namespace
+{
+	//Runs tileFunction(tileIndex) for every tile and waits for all of them
+	template<typename TileFunction>
+	void ForEachTile(uint32_t numTiles, const TileFunction& tileFunction)
+	{
+#if defined(ASYNC)
+		//ASYNC
+		const uint32_t numCores = std::thread::hardware_concurrency();
+		std::vector<std::future<void>> async_futures{};
+
+		const uint32_t numTilesPerTask = numTiles / numCores; //Int division can skip tiles
+		uint32_t numUnassignedTiles = numTiles % numCores; //Rest of division
+		uint32_t currentTileIndex = 0;
+
+		//Create task
+		for (uint32_t index{ 0 }; index < numCores; ++index)
+		{
+			uint32_t taskSize = numTilesPerTask;
+			if (numUnassignedTiles > 0)
+			{
+				++taskSize;
+				--numUnassignedTiles;
+			}
+
+			async_futures.push_back(
+				std::async(std::launch::async, [=, &tileFunction] 
+				{
+					const uint32_t tileIndexEnd = currentTileIndex + taskSize;
+					for (uint32_t tileIndex = currentTileIndex; tileIndex < tileIndexEnd; ++tileIndex)
+					{
+						tileFunction(tileIndex);
+					}
+				})
+			);
+
+			currentTileIndex += taskSize;
+		}
+
+		//Wait for all task
+		for (const std::future<void>& f : async_futures)
+		{
+			f.wait();
+		}
+
+#elif defined(PARALLEL_FOR)
+		//PARALLEL
+		Concurrency::parallel_for(0u, numTiles, [&](uint32_t tileIndex) 
+			{
+				tileFunction(tileIndex);
+			});
+
+#else
+		//SYNCHRONOUS
+		for (uint32_t tileIndex = 0; tileIndex < numTiles; tileIndex++)
+		{
+			tileFunction(tileIndex);
+		}
+#endif
+	}
+
+	uint64_t GetHitMask(const RayPacket& packet, const HitRecord* closestHits)
+	{
+		uint64_t hitMask{ 0 };
+		for (uint32_t ray = 0; ray < packet.GetRayCount(); ++ray)
+		{
+			if (closestHits[ray].didHit)
+			{
+				hitMask |= uint64_t{ 1 } << ray;
+			}
+		}
+		return hitMask;
+	}
+
+	//Shadow rays toward light for the rays in hitMask. They leave from different points, so the packet gets no frustum
+	void GenerateShadowRays(const RayPacket& packet, const HitRecord* closestHits, uint64_t hitMask, const Light& light, RayPacket& shadowPacket)
+	{
+		shadowPacket.width = packet.width;
+		shadowPacket.height = packet.height;
+		shadowPacket.activeMask = hitMask;
+
+		for (uint64_t mask = hitMask; mask != 0; mask &= mask - 1)
+		{
+			const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+			const HitRecord& closestHit = closestHits[ray];
+
+			Ray& lightRay = shadowPacket.rays[ray];
+			lightRay.origin = closestHit.origin;
+			lightRay.direction = LightUtils::GetDirectionToLight(light, lightRay.origin + closestHit.normal * 0.01f);
+			lightRay.min = 0.1f;
+			lightRay.max = lightRay.direction.Magnitude();
+			lightRay.direction.Normalize();
+		}
+	}
+}
+
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
 	m_pBuffer(SDL_GetWindowSurface(pWindow))
@@ -26,14 +124,21 @@ Renderer::Renderer(SDL_Window * pWindow) :
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+
+	//Tiles of RayPacketWidth x RayPacketWidth pixels, their primary rays get traced as one packet
+	m_NumTilesX = (m_Width + RayPacketWidth - 1) / RayPacketWidth;
+	m_NumTiles = m_NumTilesX * ((m_Height + RayPacketWidth - 1) / RayPacketWidth);
 }
 
-void Renderer::Render(Scene* pScene) const
+void Renderer::Render(Scene* pScene)
 {
 	//Camera
 	Camera& camera = pScene->GetCamera();
 	camera.CalculateCameraToWorld();
 
+	//Acceleration structure
+	pScene->UpdateTopLevelAccelerationStructure();
+
 	//Aspect Ratio
 	float aspectRatio{ m_Width / float(m_Height) };
 
@@ -45,147 +150,201 @@ void Renderer::Render(Scene* pScene) const
 	auto& materials = pScene->GetMaterials();
 	auto& lights = pScene->GetLights();
 
-	//Go through pixels
-	const uint32_t numPixels = m_Width * m_Height;
+	//Go through tiles
+	if (m_WavefrontEnabled)
+	{
+		RenderWavefront(pScene, fov, aspectRatio, camera, lights, materials);
+	}
+	else
+	{
+		ForEachTile(m_NumTiles, [&](uint32_t tileIndex)
+			{
+				RenderTile(pScene, tileIndex, fov, aspectRatio, camera, lights, materials);
+			});
+	}
 
-#if defined(ASYNC)
-	//ASYNC
-	const uint32_t numCores = std::thread::hardware_concurrency();
-	std::vector<std::future<void>> async_futures{};
+	//@END
+	//Update SDL Surface
+	SDL_UpdateWindowSurface(m_pWindow);
+}
 
-	const uint32_t numPixelsPerTask = numPixels / numCores; //Int division can skip pixels
-	uint32_t numUnassignedPixels = numPixels % numCores; //Rest of division
-	uint32_t currentPixelIndex = 0;
+void Renderer::RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+{
+	RayPacket packet{};
+	GenerateTileRays(tileIndex, fov, aspectRatio, camera, packet);
 
-	//Create task
-	for (uint32_t index{ 0 }; index < numCores; ++index)
+	HitRecord closestHits[RayPacketSize]{};
+	pScene->GetClosestHit(packet, closestHits);
+	const uint64_t hitMask = GetHitMask(packet, closestHits);
+
+	ColorRGB finalColors[RayPacketSize]{};
+	RayPacket shadowPacket{};
+
+	for (const Light& light : lights)
 	{
-		uint32_t taskSize = numPixelsPerTask;
-		if (numUnassignedPixels > 0)
+		uint64_t litMask = hitMask;
+
+		if (m_ShadowsEnabled && hitMask != 0)
 		{
-			++taskSize;
-			--numUnassignedPixels;
+			GenerateShadowRays(packet, closestHits, hitMask, light, shadowPacket);
+			litMask &= ~pScene->DoesHit(shadowPacket);
 		}
 
-		async_futures.push_back(
-			std::async(std::launch::async, [=, this] 
-			{
-				const uint32_t pixelIndexEnd = currentPixelIndex + taskSize;
-				for (uint32_t pixelIndex = currentPixelIndex; pixelIndex < pixelIndexEnd; ++pixelIndex)
-				{
-					RenderPixel(pScene, pixelIndex, fov, aspectRatio, camera, lights, materials);
-				}
-			})
-		);
-
-		currentPixelIndex += taskSize;
+		AccumulateLight(packet, closestHits, litMask, light, materials, finalColors);
 	}
 
-	//Wait for all task
-	for (const std::future<void>& f : async_futures)
-	{
-		f.wait();
-	}
+	WriteTile(tileIndex, packet, finalColors);
+}
 
-#elif defined(PARALLEL_FOR)
-	//PARALLEL
-	Concurrency::parallel_for(0u, numPixels, [=, this](int i) 
+void Renderer::RenderWavefront(Scene* pScene, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials)
+{
+	const size_t numLights = lights.size();
+	m_LitMasks.resize(m_NumTiles * numLights);
+
+	//Every stage runs over all tiles before the next one starts, and gets timed on its own
+	const auto runStage = [this](WavefrontStage stage, const auto& tileFunction)
+		{
+			const auto stageStart = std::chrono::high_resolution_clock::now();
+			ForEachTile(m_NumTiles, tileFunction);
+			m_StageTimes[static_cast<int>(stage)] += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - stageStart).count();
+		};
+
+	runStage(WavefrontStage::Generate, [&](uint32_t tileIndex)
 		{
-			RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
+			GenerateTileRays(tileIndex, fov, aspectRatio, camera, m_PrimaryPackets[tileIndex]);
 		});
 
-#else
-	//SYNCHRONOUS
-	for (uint32_t index = 0; index < numPixels; index++)
+	runStage(WavefrontStage::Intersect, [&](uint32_t tileIndex)
+		{
+			HitRecord* closestHits = &m_ClosestHits[tileIndex * RayPacketSize];
+			std::fill_n(closestHits, RayPacketSize, HitRecord{});
+
+			pScene->GetClosestHit(m_PrimaryPackets[tileIndex], closestHits);
+			m_HitMasks[tileIndex] = GetHitMask(m_PrimaryPackets[tileIndex], closestHits);
+		});
+
+	//One light at a time, so the shadow packets of a single light have to fit in memory
+	for (size_t lightIndex = 0; lightIndex < numLights; ++lightIndex)
 	{
-		RenderPixel(pScene, index, fov, aspectRatio, camera, lights, materials);
+		if (!m_ShadowsEnabled)
+		{
+			for (uint32_t tileIndex = 0; tileIndex < m_NumTiles; ++tileIndex)
+			{
+				m_LitMasks[tileIndex * numLights + lightIndex] = m_HitMasks[tileIndex];
+			}
+			continue;
+		}
+
+		runStage(WavefrontStage::ShadowGenerate, [&](uint32_t tileIndex)
+			{
+				GenerateShadowRays(m_PrimaryPackets[tileIndex], &m_ClosestHits[tileIndex * RayPacketSize], m_HitMasks[tileIndex], lights[lightIndex], m_ShadowPackets[tileIndex]);
+			});
+
+		runStage(WavefrontStage::ShadowIntersect, [&](uint32_t tileIndex)
+			{
+				m_LitMasks[tileIndex * numLights + lightIndex] = m_HitMasks[tileIndex] & ~pScene->DoesHit(m_ShadowPackets[tileIndex]);
+			});
 	}
-#endif
 
-	//@END
-	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
-}
+	runStage(WavefrontStage::Shade, [&](uint32_t tileIndex)
+		{
+			ColorRGB finalColors[RayPacketSize]{};
+			for (size_t lightIndex = 0; lightIndex < numLights; ++lightIndex)
+			{
+				AccumulateLight(m_PrimaryPackets[tileIndex], &m_ClosestHits[tileIndex * RayPacketSize], m_LitMasks[tileIndex * numLights + lightIndex], lights[lightIndex], materials, finalColors);
+			}
 
-void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
-{
-	const int px = pixelIndex % m_Width;
-	const int py = pixelIndex / m_Width;
+			WriteTile(tileIndex, m_PrimaryPackets[tileIndex], finalColors);
+		});
 
-	float gradient	 = px / static_cast<float>(m_Width);
-	gradient		+= py / static_cast<float>(m_Width);
-	gradient /= 2.0f;	
+	++m_WavefrontFrames;
+}
 
-	float cx = ((2 * (px + 0.5f)) / m_Width - 1) * aspectRatio * fov;
-	float cy = (1 - (2 * (py + 0.5f)) / m_Height) * fov;
+void Renderer::GenerateTileRays(uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, RayPacket& packet) const
+{
+	const int tileX = static_cast<int>((tileIndex % m_NumTilesX) * RayPacketWidth);
+	const int tileY = static_cast<int>((tileIndex / m_NumTilesX) * RayPacketWidth);
 
-	//Ray calculation
-	Vector3 rayDirection{ cx, cy, 1 };
-	rayDirection.Normalize();
+	//Tiles on the right and bottom edge can be smaller
+	packet.width = static_cast<uint32_t>(std::min(static_cast<int>(RayPacketWidth), m_Width - tileX));
+	packet.height = static_cast<uint32_t>(std::min(static_cast<int>(RayPacketWidth), m_Height - tileY));
 
 	const Matrix cameraToWorld = camera.cameraToWorld;
-	rayDirection = cameraToWorld.TransformVector(rayDirection);
+	for (uint32_t y = 0; y < packet.height; ++y)
+	{
+		for (uint32_t x = 0; x < packet.width; ++x)
+		{
+			const int px = tileX + static_cast<int>(x);
+			const int py = tileY + static_cast<int>(y);
 
-	Ray viewRay{ camera.origin,  rayDirection };
+			float cx = ((2 * (px + 0.5f)) / m_Width - 1) * aspectRatio * fov;
+			float cy = (1 - (2 * (py + 0.5f)) / m_Height) * fov;
 
-	ColorRGB finalColor{};
-	HitRecord closestHit{};
+			//Ray calculation
+			Vector3 rayDirection{ cx, cy, 1 };
+			rayDirection.Normalize();
+			rayDirection = cameraToWorld.TransformVector(rayDirection);
 
-	pScene->GetClosestHit(viewRay, closestHit);
-	if (closestHit.didHit)
-	{
-		for (size_t index = 0; index < lights.size(); index++)
-		{
-			Vector3 lightDirection = LightUtils::GetDirectionToLight(lights[index], closestHit.origin + closestHit.normal * 0.01f);
-			const float normalLight{ Vector3::Dot(closestHit.normal, lightDirection)};
-			lightDirection.Normalize();			
+			packet.rays[y * packet.width + x] = Ray{ camera.origin, rayDirection };
+		}
+	}
+	packet.SetAllActive();
+	packet.UpdateFrustum();
+}
 
-			if (m_ShadowsEnabled)
-			{
-				Ray lightRay{};
-				lightRay.origin = closestHit.origin;
-				lightRay.direction = LightUtils::GetDirectionToLight(lights[index], lightRay.origin + closestHit.normal * 0.01f);
-				lightRay.min = 0.1f;
-				lightRay.max = lightRay.direction.Magnitude();
-				lightRay.direction.Normalize();
-
-				if (pScene->DoesHit(lightRay))
-				{
-					continue;
-				}
-			}
+void Renderer::AccumulateLight(const RayPacket& packet, const HitRecord* closestHits, uint64_t litMask, const Light& light, const std::vector<Material*>& materials, ColorRGB* finalColors) const
+{
+	for (uint64_t mask = litMask; mask != 0; mask &= mask - 1)
+	{
+		const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+		finalColors[ray] += ShadeLight(light, closestHits[ray], packet.rays[ray].direction, materials);
+	}
+}
 
+void Renderer::WriteTile(uint32_t tileIndex, const RayPacket& packet, ColorRGB* finalColors) const
+{
+	const int tileX = static_cast<int>((tileIndex % m_NumTilesX) * RayPacketWidth);
+	const int tileY = static_cast<int>((tileIndex / m_NumTilesX) * RayPacketWidth);
 
-			switch (m_CurrentLightingMode)
-			{
-			case dae::Renderer::LightingMode::ObservedArea:
-				finalColor += ColorRGB{ normalLight, normalLight, normalLight };
-				break;
-			case dae::Renderer::LightingMode::Radiance:
-				finalColor += LightUtils::GetRadiance(lights[index], closestHit.origin);				
-				break;
-			case dae::Renderer::LightingMode::BRDF:
-				finalColor += materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, rayDirection);
-				break;
-			case dae::Renderer::LightingMode::Combined:
-				const float dotProduct = std::max(Vector3::Dot(closestHit.normal, lightDirection), 0.f);
-				//Dot products always gives 0
-				const ColorRGB IncidentRadiance{ LightUtils::GetRadiance(lights[index], closestHit.origin) };
-				const ColorRGB BRDF = materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, viewRay.direction);
-
-				finalColor += IncidentRadiance * BRDF * dotProduct;
-				break;
-			}
+	for (uint32_t y = 0; y < packet.height; ++y)
+	{
+		for (uint32_t x = 0; x < packet.width; ++x)
+		{
+			//Update Color in Buffer
+			ColorRGB& finalColor = finalColors[y * packet.width + x];
+			finalColor.MaxToOne();
+
+			m_pBufferPixels[tileX + static_cast<int>(x) + ((tileY + static_cast<int>(y)) * m_Width)] = SDL_MapRGB(m_pBuffer->format,
+				static_cast<uint8_t>(finalColor.r * 255),
+				static_cast<uint8_t>(finalColor.g * 255),
+				static_cast<uint8_t>(finalColor.b * 255));
 		}
 	}
+}
 
-	//Update Color in Buffer
-	finalColor.MaxToOne();
+ColorRGB Renderer::ShadeLight(const Light& light, const HitRecord& closestHit, const Vector3& viewDirection, const std::vector<Material*>& materials) const
+{
+	Vector3 lightDirection = LightUtils::GetDirectionToLight(light, closestHit.origin + closestHit.normal * 0.01f);
+	const float normalLight{ Vector3::Dot(closestHit.normal, lightDirection)};
+	lightDirection.Normalize();
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	switch (m_CurrentLightingMode)
+	{
+	case dae::Renderer::LightingMode::ObservedArea:
+		return ColorRGB{ normalLight, normalLight, normalLight };
+	case dae::Renderer::LightingMode::Radiance:
+		return LightUtils::GetRadiance(light, closestHit.origin);
+	case dae::Renderer::LightingMode::BRDF:
+		return materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, viewDirection);
+	case dae::Renderer::LightingMode::Combined:
+	default:
+		const float dotProduct = std::max(Vector3::Dot(closestHit.normal, lightDirection), 0.f);
+		//Dot products always gives 0
+		const ColorRGB IncidentRadiance{ LightUtils::GetRadiance(light, closestHit.origin) };
+		const ColorRGB BRDF = materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, viewDirection);
+
+		return IncidentRadiance * BRDF * dotProduct;
+	}
 }
 
 bool Renderer::SaveBufferToImage() const
@@ -234,4 +393,56 @@ void Renderer::SwitchShadows()
 	{
 		std::cout << "off\n------------\n";
 	}
+}
+
+void Renderer::SwitchWavefront()
+{
+	m_WavefrontEnabled = !m_WavefrontEnabled;
+
+	//The stage buffers only exist while the mode is on
+	if (m_WavefrontEnabled)
+	{
+		m_PrimaryPackets.resize(m_NumTiles);
+		m_ClosestHits.resize(m_NumTiles * RayPacketSize);
+		m_HitMasks.resize(m_NumTiles);
+		m_ShadowPackets.resize(m_NumTiles);
+	}
+	else
+	{
+		std::vector<RayPacket>().swap(m_PrimaryPackets);
+		std::vector<HitRecord>().swap(m_ClosestHits);
+		std::vector<uint64_t>().swap(m_HitMasks);
+		std::vector<RayPacket>().swap(m_ShadowPackets);
+		std::vector<uint64_t>().swap(m_LitMasks);
+	}
+
+	std::cout << "------------\nWavefront rendering: ";
+	if (m_WavefrontEnabled)
+	{
+		std::cout << "on\n------------\n";
+	}
+	else
+	{
+		std::cout << "off\n------------\n";
+	}
+}
+
+void Renderer::PrintWavefrontStats()
+{
+	if (!m_WavefrontEnabled || m_WavefrontFrames == 0)
+	{
+		return;
+	}
+
+	const char* stageNames[]{ "generate", "intersect", "shadow generate", "shadow intersect", "shade" };
+
+	std::cout << "Wavefront stages (ms/frame):";
+	for (int stage = 0; stage < static_cast<int>(WavefrontStage::Count); ++stage)
+	{
+		std::cout << " " << stageNames[stage] << " " << m_StageTimes[stage] / m_WavefrontFrames;
+		m_StageTimes[stage] = 0.f;
+	}
+	std::cout << "\n";
+
+	m_WavefrontFrames = 0;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "DataTypes.h"
+
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -25,16 +27,31 @@ namespace dae
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
+		void Render(Scene* pScene);
 		bool SaveBufferToImage() const;
 
 
 		//Optimization
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		//Traces the primary rays of one RayPacketWidth x RayPacketWidth tile as a packet, then its shadow rays as one packet per light
+		void RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		//Renders every step of RenderTile over all tiles before the next step, see SwitchWavefront
+		void RenderWavefront(Scene* pScene, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials);
+
+		//Steps of a tile shared by both modes
+		void GenerateTileRays(uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, RayPacket& packet) const;
+		//Adds what one light contributes to the pixels of the rays in litMask
+		void AccumulateLight(const RayPacket& packet, const HitRecord* closestHits, uint64_t litMask, const Light& light, const std::vector<Material*>& materials, ColorRGB* finalColors) const;
+		void WriteTile(uint32_t tileIndex, const RayPacket& packet, ColorRGB* finalColors) const;
+		//Light reflected toward the viewer by the hit point, before shadows
+		ColorRGB ShadeLight(const Light& light, const HitRecord& closestHit, const Vector3& viewDirection, const std::vector<Material*>& materials) const;
 
 
 		void ModeSwitcher();
 		void SwitchShadows();
+		//Wavefront mode: generate, intersect, shadow rays and shading each run over the whole frame in turn instead of per tile
+		void SwitchWavefront();
+		//Average time of every wavefront stage since the last call, prints nothing while the mode is off
+		void PrintWavefrontStats();
 
 	private:
 		SDL_Window* m_pWindow{};
@@ -56,5 +73,29 @@ namespace dae
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 		bool m_ShadowsEnabled{ false };
 
+		uint32_t m_NumTilesX{};
+		uint32_t m_NumTiles{};
+
+		enum class WavefrontStage
+		{
+			Generate,
+			Intersect,
+			ShadowGenerate,
+			ShadowIntersect,
+			Shade,
+			Count
+		};
+
+		//Wavefront mode, the output of every stage for all tiles
+		bool m_WavefrontEnabled{ false };
+		std::vector<RayPacket> m_PrimaryPackets{};
+		std::vector<HitRecord> m_ClosestHits{};		//RayPacketSize per tile
+		std::vector<uint64_t> m_HitMasks{};
+		std::vector<RayPacket> m_ShadowPackets{};		//Refilled for every light
+		std::vector<uint64_t> m_LitMasks{};			//Per tile and light, the rays that light reaches
+
+		float m_StageTimes[static_cast<int>(WavefrontStage::Count)]{};
+		uint32_t m_WavefrontFrames{};
+
 	};
 }
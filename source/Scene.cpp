@@ -2,6 +2,9 @@
 #include "Utils.h"
 #include "Material.h"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
 #include <iostream>
 
 namespace dae {
@@ -15,6 +18,9 @@ namespace dae {
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
 		m_Lights.reserve(32);
+
+		//Top-level leaves are costed per sphere block, meshes in a leaf get tested one by one either way
+		m_TopLevelAccelerationStructure.GetBVH().SetLeafBlockSize(SphereBlockWidth);
 	}
 
 	Scene::~Scene()
@@ -31,91 +37,796 @@ namespace dae {
 	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
 	{
 		//todo W1
-		for (size_t index = 0; index < m_SphereGeometries.size(); index++)
+		//Only the distance and what got hit are tracked while testing, the hit record is resolved once for the final hit
+		HitCandidate closest{};
+		closest.t = closestHit.t;
+		bool closestIsPlane{ false };
+
+		HitTest_Planes(ray, closest, closestIsPlane);
+
+		//Start from the closest plane so the BVH can cull everything behind it
+		Ray bvhRay{ ray };
+		bvhRay.max = std::min(ray.max, closest.t);
+
+		//BVH leaves test their sphere blocks at once
+		if (m_TopLevelAccelerationStructure.GetType() == AccelerationType::BVH)
+		{
+			GeometryUtils::HitTest_BVH(m_TopLevelAccelerationStructure.GetBVH(), bvhRay, [&](uint32_t first, uint32_t count, Ray& nodeRay)
+				{
+					const uint32_t meshCount = m_LeafMeshCounts[first];
+					bool foundInLeaf = HitTest_LeafSpheres(first, count - meshCount, nodeRay, closest, closestIsPlane);
+
+					const std::vector<uint32_t>& primitiveIndices = m_TopLevelAccelerationStructure.GetBVH().GetPrimitiveIndices();
+					for (uint32_t index = first; meshCount > 0 && index < first + count; ++index)
+					{
+						const uint32_t primitiveIndex = primitiveIndices[index];
+						if (primitiveIndex >= m_TopLevelSphereCount && HitTest_Mesh(primitiveIndex, nodeRay, closest, closestIsPlane))
+						{
+							foundInLeaf = true;
+						}
+					}
+
+					return foundInLeaf;
+				});
+		}
+		else
+		{
+			GeometryUtils::HitTest_AccelerationStructure(m_TopLevelAccelerationStructure, bvhRay, [&](uint32_t primitiveIndex, Ray& nodeRay)
+				{
+					if (primitiveIndex >= m_TopLevelSphereCount)
+					{
+						return HitTest_Mesh(primitiveIndex, nodeRay, closest, closestIsPlane);
+					}
+
+					HitCandidate sphereHit{};
+					if (!GeometryUtils::HitTest_Sphere<GeometryUtils::HitQuery::ClosestHit>(m_SphereGeometries[primitiveIndex], nodeRay, sphereHit) || sphereHit.t >= closest.t)
+					{
+						return false;
+					}
+
+					closest.t = sphereHit.t;
+					nodeRay.max = sphereHit.t;
+					closest.primitiveIndex = primitiveIndex;
+					closestIsPlane = false;
+					return true;
+				});
+		}
+
+		ResolveClosestHit(ray, closest, closestIsPlane, closestHit);
+	}
+
+	void Scene::GetClosestHit(const RayPacket& packet, HitRecord* closestHits) const
+	{
+		//Only BVHs have a packet traversal, grids and kd-trees trace the rays one by one
+		if (m_TopLevelAccelerationStructure.GetType() != AccelerationType::BVH)
+		{
+			for (uint64_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+			{
+				const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+				GetClosestHit(packet.rays[ray], closestHits[ray]);
+			}
+			return;
+		}
+
+		HitCandidate closest[RayPacketSize];
+		bool closestIsPlane[RayPacketSize];
+		Ray nodeRays[RayPacketSize];
+		RayBlock rayBlocks[RayPacketBlockCount];
+		for (uint64_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+		{
+			const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+
+			closest[ray].t = closestHits[ray].t;
+			closestIsPlane[ray] = false;
+
+			nodeRays[ray] = packet.rays[ray];
+			nodeRays[ray].max = std::min(packet.rays[ray].max, closest[ray].t);
+			rayBlocks[ray / RayBlockWidth].SetLane(ray % RayBlockWidth, nodeRays[ray]);
+		}
+
+		//Keeps the slab tests of the packet in line with the closest hit of every ray
+		const auto shrinkRay = [&](uint32_t ray)
+			{
+				nodeRays[ray].max = closest[ray].t;
+				rayBlocks[ray / RayBlockWidth].max[ray % RayBlockWidth] = closest[ray].t;
+			};
+
+		//Planes and spheres get tested against a block of rays at a time, t holds the distance of every lane
+		float t[RayBlockWidth];
+		const auto recordCloser = [&](uint32_t block, uint32_t hitMask, uint32_t primitiveIndex, bool isPlane)
+			{
+				for (; hitMask != 0; hitMask &= hitMask - 1)
+				{
+					const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+					const uint32_t ray = block * RayBlockWidth + lane;
+					if (t[lane] < closest[ray].t)
+					{
+						closest[ray].t = t[lane];
+						closest[ray].primitiveIndex = primitiveIndex;
+						closestIsPlane[ray] = isPlane;
+						shrinkRay(ray);
+					}
+				}
+			};
+
+		//Planes first, like for single rays
+		for (uint32_t plane = 0; plane < m_PlaneGeometries.size(); ++plane)
+		{
+			GeometryUtils::ForEachRayBlock(packet.activeMask, [&](uint32_t block, uint32_t laneMask)
+				{
+					const uint32_t hitMask = GeometryUtils::HitTest_PlaneRayBlock(m_PlaneGeometries[plane], rayBlocks[block], t) & laneMask;
+					recordCloser(block, hitMask, plane, true);
+					return hitMask;
+				});
+		}
+
+		const std::vector<uint32_t>& primitiveIndices = m_TopLevelAccelerationStructure.GetBVH().GetPrimitiveIndices();
+		GeometryUtils::HitTest_BVHPacket(m_TopLevelAccelerationStructure.GetBVH(), packet.frustum, rayBlocks, packet.activeMask, [&](uint32_t first, uint32_t count, uint64_t leafMask)
+			{
+				for (uint32_t index = first; index < first + count; ++index)
+				{
+					const uint32_t primitiveIndex = primitiveIndices[index];
+					if (primitiveIndex < m_TopLevelSphereCount)
+					{
+						GeometryUtils::ForEachRayBlock(leafMask, [&](uint32_t block, uint32_t laneMask)
+							{
+								const uint32_t hitMask = GeometryUtils::HitTest_SphereRayBlock(m_SphereGeometries[primitiveIndex], rayBlocks[block], t) & laneMask;
+								recordCloser(block, hitMask, primitiveIndex, false);
+								return hitMask;
+							});
+					}
+				}
+
+				for (uint32_t index = first; m_LeafMeshCounts[first] > 0 && index < first + count; ++index)
+				{
+					const uint32_t primitiveIndex = primitiveIndices[index];
+					if (primitiveIndex < m_TopLevelSphereCount)
+					{
+						continue;
+					}
+
+					//The leaf box can reach into the frustum while the mesh itself stays outside it
+					const TriangleMesh& mesh = m_TriangleMeshGeometries[primitiveIndex - m_TopLevelSphereCount];
+					if (packet.frustum.IsOutside(mesh.transformedMinAABB, mesh.transformedMaxAABB))
+					{
+						continue;
+					}
+
+					const uint64_t closerMask = GeometryUtils::HitTest_TriangleMeshPacket<GeometryUtils::HitQuery::ClosestHit>(mesh, packet.frustum, nodeRays, leafMask, closest);
+					for (uint64_t mask = closerMask; mask != 0; mask &= mask - 1)
+					{
+						const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+						closest[ray].primitiveIndex = primitiveIndex;
+						closestIsPlane[ray] = false;
+						shrinkRay(ray);
+					}
+				}
+
+				return uint64_t{ 0 };
+			});
+
+		for (uint64_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
 		{
-			if (index != 0)
+			const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+			ResolveClosestHit(packet.rays[ray], closest[ray], closestIsPlane[ray], closestHits[ray]);
+		}
+	}
+
+	void Scene::HitTest_Planes(const Ray& ray, HitCandidate& closest, bool& closestIsPlane) const
+	{
+		//All planes are tested at once per block
+		float planeT[PlaneBlockWidth];
+		for (const PlaneBlock& block : m_PlaneBlocks)
+		{
+			uint32_t hitMask = GeometryUtils::HitTest_PlaneBlock(block, ray, planeT);
+			while (hitMask)
 			{
-				HitRecord tempHitRecord{};
-				GeometryUtils::HitTest_Sphere(m_SphereGeometries[index], ray, tempHitRecord);
-				if (tempHitRecord.t < closestHit.t)
+				const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+				hitMask &= hitMask - 1;
+
+				if (planeT[lane] < closest.t)
 				{
-					closestHit = tempHitRecord;
+					closest.t = planeT[lane];
+					closest.primitiveIndex = block.plane[lane];
+					closestIsPlane = true;
 				}
 			}
-			else
+		}
+	}
+
+	bool Scene::HitTest_LeafSpheres(uint32_t first, uint32_t sphereCount, Ray& nodeRay, HitCandidate& closest, bool& closestIsPlane) const
+	{
+		bool foundCloser{ false };
+
+		const uint32_t blockStart = m_LeafSphereBlockStarts[first];
+		const uint32_t blockEnd = blockStart + (sphereCount + SphereBlockWidth - 1) / SphereBlockWidth;
+
+		float t[SphereBlockWidth];
+		for (uint32_t block = blockStart; block < blockEnd; ++block)
+		{
+			uint32_t hitMask = GeometryUtils::HitTest_SphereBlock(m_SphereBlocks[block], nodeRay, t);
+			while (hitMask)
 			{
-				GeometryUtils::HitTest_Sphere(m_SphereGeometries[index], ray, closestHit);
+				const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+				hitMask &= hitMask - 1;
+
+				if (t[lane] < closest.t)
+				{
+					closest.t = t[lane];
+					nodeRay.max = t[lane];
+					closest.primitiveIndex = m_SphereBlocks[block].sphere[lane];
+					closestIsPlane = false;
+					foundCloser = true;
+				}
 			}
 		}
 
-		for (size_t index = 0; index < m_PlaneGeometries.size(); index++)
+		return foundCloser;
+	}
+
+	bool Scene::HitTest_Mesh(uint32_t primitiveIndex, Ray& nodeRay, HitCandidate& closest, bool& closestIsPlane) const
+	{
+		//Only keeps triangles closer than closest.t
+		if (!GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::ClosestHit>(m_TriangleMeshGeometries[primitiveIndex - m_TopLevelSphereCount], nodeRay, closest))
+		{
+			return false;
+		}
+
+		nodeRay.max = closest.t;
+		closest.primitiveIndex = primitiveIndex;
+		closestIsPlane = false;
+		return true;
+	}
+
+	void Scene::ResolveClosestHit(const Ray& ray, const HitCandidate& closest, bool closestIsPlane, HitRecord& closestHit) const
+	{
+		if (closest.primitiveIndex == UINT32_MAX)
+		{
+			return;
+		}
+
+		if (closestIsPlane)
+		{
+			GeometryUtils::ResolveHit(m_PlaneGeometries[closest.primitiveIndex], ray, closest.t, closestHit);
+		}
+		else if (closest.primitiveIndex < m_TopLevelSphereCount)
+		{
+			GeometryUtils::ResolveHit(m_SphereGeometries[closest.primitiveIndex], ray, closest.t, closestHit);
+		}
+		else
+		{
+			GeometryUtils::ResolveHit(m_TriangleMeshGeometries[closest.primitiveIndex - m_TopLevelSphereCount], closest.triangleIndex, ray, closest.t, closestHit);
+		}
+	}
+
+	bool Scene::DoesHit(const Ray& ray) const
+	{
+		//todo W3
+		for (const PlaneBlock& block : m_PlaneBlocks)
+		{
+			if (GeometryUtils::HitTest_PlaneBlock<GeometryUtils::HitQuery::AnyHit>(block, ray, nullptr))
+			{
+				return true;
+			}
+		}
+
+		if (m_TopLevelAccelerationStructure.GetType() == AccelerationType::BVH)
+		{
+			const std::vector<uint32_t>& primitiveIndices = m_TopLevelAccelerationStructure.GetBVH().GetPrimitiveIndices();
+			return GeometryUtils::OcclusionTest_BVH(m_TopLevelAccelerationStructure.GetBVH(), ray, [&](uint32_t first, uint32_t count, Ray& nodeRay)
+				{
+					const uint32_t meshCount = m_LeafMeshCounts[first];
+					const uint32_t blockStart = m_LeafSphereBlockStarts[first];
+					const uint32_t blockEnd = blockStart + (count - meshCount + SphereBlockWidth - 1) / SphereBlockWidth;
+
+					for (uint32_t block = blockStart; block < blockEnd; ++block)
+					{
+						if (GeometryUtils::HitTest_SphereBlock<GeometryUtils::HitQuery::AnyHit>(m_SphereBlocks[block], nodeRay, nullptr))
+						{
+							return true;
+						}
+					}
+
+					for (uint32_t index = first; meshCount > 0 && index < first + count; ++index)
+					{
+						const uint32_t primitiveIndex = primitiveIndices[index];
+						if (primitiveIndex >= m_TopLevelSphereCount && GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[primitiveIndex - m_TopLevelSphereCount], nodeRay))
+						{
+							return true;
+						}
+					}
+					return false;
+				});
+		}
+
+		return GeometryUtils::OcclusionTest_AccelerationStructure(m_TopLevelAccelerationStructure, ray, [&](uint32_t primitiveIndex, Ray& nodeRay)
+			{
+				if (primitiveIndex < m_TopLevelSphereCount)
+				{
+					return GeometryUtils::HitTest_Sphere(m_SphereGeometries[primitiveIndex], nodeRay);
+				}
+				return GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[primitiveIndex - m_TopLevelSphereCount], nodeRay);
+			});
+	}
+
+	uint64_t Scene::DoesHit(const RayPacket& packet) const
+	{
+		RayBlock rayBlocks[RayPacketBlockCount];
+		for (uint64_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+		{
+			const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+			rayBlocks[ray / RayBlockWidth].SetLane(ray % RayBlockWidth, packet.rays[ray]);
+		}
+
+		//Planes first, like for single rays
+		uint64_t occludedMask{ 0 };
+		for (const Plane& plane : m_PlaneGeometries)
+		{
+			occludedMask |= GeometryUtils::ForEachRayBlock(packet.activeMask & ~occludedMask, [&](uint32_t block, uint32_t)
+				{
+					return GeometryUtils::HitTest_PlaneRayBlock<GeometryUtils::HitQuery::AnyHit>(plane, rayBlocks[block], nullptr);
+				});
+		}
+
+		const uint64_t activeMask = packet.activeMask & ~occludedMask;
+		if (activeMask == 0)
+		{
+			return occludedMask;
+		}
+
+		//Only BVHs have a packet traversal, grids and kd-trees trace the rays one by one
+		if (m_TopLevelAccelerationStructure.GetType() != AccelerationType::BVH)
+		{
+			for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+			{
+				const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+				if (DoesHit(packet.rays[ray]))
+				{
+					occludedMask |= uint64_t{ 1 } << ray;
+				}
+			}
+			return occludedMask;
+		}
+
+		const std::vector<uint32_t>& primitiveIndices = m_TopLevelAccelerationStructure.GetBVH().GetPrimitiveIndices();
+		GeometryUtils::HitTest_BVHPacket(m_TopLevelAccelerationStructure.GetBVH(), packet.frustum, rayBlocks, activeMask, [&](uint32_t first, uint32_t count, uint64_t leafMask)
+			{
+				uint64_t blockedMask{ 0 };
+
+				for (uint32_t index = first; index < first + count && (leafMask & ~blockedMask) != 0; ++index)
+				{
+					const uint32_t primitiveIndex = primitiveIndices[index];
+					if (primitiveIndex < m_TopLevelSphereCount)
+					{
+						blockedMask |= GeometryUtils::ForEachRayBlock(leafMask & ~blockedMask, [&](uint32_t block, uint32_t)
+							{
+								return GeometryUtils::HitTest_SphereRayBlock<GeometryUtils::HitQuery::AnyHit>(m_SphereGeometries[primitiveIndex], rayBlocks[block], nullptr);
+							});
+					}
+				}
+
+				for (uint32_t index = first; m_LeafMeshCounts[first] > 0 && index < first + count && (leafMask & ~blockedMask) != 0; ++index)
+				{
+					const uint32_t primitiveIndex = primitiveIndices[index];
+					if (primitiveIndex < m_TopLevelSphereCount)
+					{
+						continue;
+					}
+
+					const TriangleMesh& mesh = m_TriangleMeshGeometries[primitiveIndex - m_TopLevelSphereCount];
+					if (packet.frustum.IsOutside(mesh.transformedMinAABB, mesh.transformedMaxAABB))
+					{
+						continue;
+					}
+
+					blockedMask |= GeometryUtils::HitTest_TriangleMeshPacket<GeometryUtils::HitQuery::AnyHit>(mesh, packet.frustum, packet.rays, leafMask & ~blockedMask, nullptr);
+				}
+
+				occludedMask |= blockedMask;
+				return blockedMask;
+			});
+
+		return occludedMask;
+	}
+
+	void Scene::UpdateTopLevelAccelerationStructure()
+	{
+		//Static scenes keep the top level of the previous frame
+		bool dirty = m_TopLevelDirty;
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
+		{
+			dirty |= mesh.transformChanged;
+			mesh.transformChanged = false;
+		}
+
+		if (!dirty)
+		{
+			return;
+		}
+		m_TopLevelDirty = false;
+
+		std::vector<Vector3> minBounds{};
+		std::vector<Vector3> maxBounds{};
+		minBounds.reserve(m_SphereGeometries.size() + m_TriangleMeshGeometries.size());
+		maxBounds.reserve(m_SphereGeometries.size() + m_TriangleMeshGeometries.size());
+
+		for (const Sphere& sphere : m_SphereGeometries)
 		{
-			HitRecord tempHitRecord{};
-			GeometryUtils::HitTest_Plane(m_PlaneGeometries[index], ray, tempHitRecord);
+			const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+			minBounds.push_back(sphere.origin - extent);
+			maxBounds.push_back(sphere.origin + extent);
+		}
+		m_TopLevelSphereCount = static_cast<uint32_t>(m_SphereGeometries.size());
 
-			if (tempHitRecord.t < closestHit.t)
+		for (const TriangleMesh& mesh : m_TriangleMeshGeometries)
+		{
+			if (mesh.GetGeometry().accelerationStructure.IsEmpty())
 			{
-				closestHit = tempHitRecord;
+				minBounds.push_back({ FLT_MAX, FLT_MAX, FLT_MAX });
+				maxBounds.push_back({ -FLT_MAX, -FLT_MAX, -FLT_MAX });
+				continue;
 			}
+			minBounds.push_back(mesh.transformedMinAABB);
+			maxBounds.push_back(mesh.transformedMaxAABB);
 		}
 
-		/*for (size_t index = 0; index < m_Triangles.size(); index++)
+		m_TopLevelAccelerationStructure.Update(minBounds, maxBounds);
+		UpdateSphereBlocks();
+		UpdatePlaneBlocks();
+	}
+
+	void Scene::UpdatePlaneBlocks()
+	{
+		m_PlaneBlocks.clear();
+		for (uint32_t index = 0; index < m_PlaneGeometries.size(); ++index)
 		{
-			HitRecord tempHitRecord{};
-			GeometryUtils::HitTest_Triangle(m_Triangles[index], ray, tempHitRecord);
+			const uint32_t lane = index % PlaneBlockWidth;
+			if (lane == 0)
+			{
+				m_PlaneBlocks.emplace_back();
+			}
+
+			const Plane& plane = m_PlaneGeometries[index];
+			PlaneBlock& block = m_PlaneBlocks.back();
+			block.originX[lane] = plane.origin.x;
+			block.originY[lane] = plane.origin.y;
+			block.originZ[lane] = plane.origin.z;
+			block.normalX[lane] = plane.normal.x;
+			block.normalY[lane] = plane.normal.y;
+			block.normalZ[lane] = plane.normal.z;
+			block.plane[lane] = index;
+		}
+	}
+
+	void Scene::UpdateSphereBlocks()
+	{
+		m_SphereBlocks.clear();
+		m_LeafSphereBlockStarts.clear();
+		m_LeafMeshCounts.clear();
+
+		if (m_TopLevelAccelerationStructure.GetType() != AccelerationType::BVH || m_TopLevelAccelerationStructure.IsEmpty())
+		{
+			return;
+		}
 
-			if (tempHitRecord.t < closestHit.t)
+		const BVH& bvh = m_TopLevelAccelerationStructure.GetBVH();
+		const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+		m_LeafSphereBlockStarts.resize(primitiveIndices.size());
+		m_LeafMeshCounts.resize(primitiveIndices.size());
+
+		for (const BVHNode& node : bvh.GetNodes())
+		{
+			if (!node.IsLeaf())
+			{
+				continue;
+			}
+
+			m_LeafSphereBlockStarts[node.leftFirst] = static_cast<uint32_t>(m_SphereBlocks.size());
+
+			//Spheres can sit anywhere in the leaf between the meshes, so lanes are filled as they come
+			uint32_t lane{ SphereBlockWidth };
+			for (uint32_t index = node.leftFirst; index < node.leftFirst + node.primitiveCount; ++index)
 			{
-				closestHit = tempHitRecord;
+				const uint32_t sphereIndex = primitiveIndices[index];
+				if (sphereIndex >= m_TopLevelSphereCount)
+				{
+					++m_LeafMeshCounts[node.leftFirst];
+					continue;
+				}
+
+				if (lane == SphereBlockWidth)
+				{
+					SphereBlock& block = m_SphereBlocks.emplace_back();
+					std::fill(std::begin(block.radiusSquared), std::end(block.radiusSquared), -1.f);
+					lane = 0;
+				}
+
+				const Sphere& sphere = m_SphereGeometries[sphereIndex];
+				SphereBlock& block = m_SphereBlocks.back();
+				block.originX[lane] = sphere.origin.x;
+				block.originY[lane] = sphere.origin.y;
+				block.originZ[lane] = sphere.origin.z;
+				block.radiusSquared[lane] = sphere.radius * sphere.radius;
+				block.sphere[lane] = sphereIndex;
+				++lane;
 			}
-		}*/
+		}
+	}
 
+	void Scene::PrintAccelerationStats() const
+	{
+		std::cout << "------------\nAcceleration stats: " << sceneName << '\n';
 		for (size_t index = 0; index < m_TriangleMeshGeometries.size(); index++)
 		{
-			HitRecord tempHitRecord{};
-			GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[index], ray, tempHitRecord);
+			const TriangleMesh& mesh = m_TriangleMeshGeometries[index];
+			if (mesh.pInstanceSource)
+			{
+				std::cout << "Mesh " << index << ": instance\n";
+				continue;
+			}
+
+			const AccelerationStructure& accelerationStructure = mesh.accelerationStructure;
+			std::cout << "Mesh " << index << ": " << accelerationStructure.GetPrimitiveCount() << " triangles, "
+				<< mesh.GetGeometrySize() / 1024 << "KB of " << (mesh.IsCompact() ? "compact " : "") << "geometry, "
+				<< AccelerationStructure::GetTypeName(accelerationStructure.GetType()) << ", ";
 
-			if (tempHitRecord.t < closestHit.t)
+			switch (accelerationStructure.GetType())
+			{
+			case AccelerationType::BVH:
+			{
+				const BVHBuildStats& stats = accelerationStructure.GetBVH().GetBuildStats();
+				std::cout << stats.nodeCount << " nodes (" << stats.leafCount << " leaves, " << stats.referenceCount << " references), "
+					<< "build " << stats.buildTime << "ms, SAH cost " << stats.cost << ", "
+					<< stats.traversalMemory / 1024 << "KB of nodes, "
+					<< "estimated cache misses per ray L1 " << stats.buildOrderCache.l1Misses << " -> " << stats.treeletOrderCache.l1Misses
+					<< ", L2 " << stats.buildOrderCache.l2Misses << " -> " << stats.treeletOrderCache.l2Misses << "\n";
+				break;
+			}
+			case AccelerationType::Grid:
 			{
-				closestHit = tempHitRecord;
+				const Grid& grid = accelerationStructure.GetGrid();
+				std::cout << grid.GetResolution()[0] << "x" << grid.GetResolution()[1] << "x" << grid.GetResolution()[2] << " cells ("
+					<< grid.GetCellPrimitives().size() << " references), build " << grid.GetBuildTime() << "ms\n";
+				break;
+			}
+			case AccelerationType::KdTree:
+			{
+				const KdTree& kdTree = accelerationStructure.GetKdTree();
+				std::cout << kdTree.GetNodes().size() << " nodes (" << kdTree.GetPrimitiveIndices().size() << " references), "
+					<< "build " << kdTree.GetBuildTime() << "ms\n";
+				break;
+			}
 			}
 		}
+		std::cout << "------------\n";
 	}
 
-	bool Scene::DoesHit(const Ray& ray) const
+	void Scene::SwitchBVHLayout()
 	{
-		//todo W3
-		for (size_t index = 0; index < m_SphereGeometries.size(); index++)
+		BVHLayout layout{};
+		switch (m_TopLevelAccelerationStructure.GetBVH().GetLayout())
+		{
+		case BVHLayout::Binary:
+			layout = BVHLayout::Wide;
+			std::cout << "------------\nBVH LAYOUT: WIDE\n------------\n";
+			break;
+		case BVHLayout::Wide:
+			layout = BVHLayout::Compressed;
+			std::cout << "------------\nBVH LAYOUT: COMPRESSED\n------------\n";
+			break;
+		case BVHLayout::Compressed:
+			layout = BVHLayout::Binary;
+			std::cout << "------------\nBVH LAYOUT: BINARY\n------------\n";
+			break;
+		}
+
+		//Clearing forces a full build with the new layout on the next update
+		m_TopLevelAccelerationStructure.GetBVH().SetLayout(layout);
+		m_TopLevelAccelerationStructure.Clear();
+		m_TopLevelDirty = true;
+
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_Sphere(m_SphereGeometries[index], ray))
+			if (mesh.pInstanceSource)
 			{
-				return true;
+				continue;
 			}
+			mesh.accelerationStructure.GetBVH().SetLayout(layout);
+			mesh.accelerationStructure.Clear();
+			mesh.UpdateAccelerationStructure();
 		}
-		for (size_t index = 0; index < m_PlaneGeometries.size(); index++)
+
+		PrintAccelerationStats();
+	}
+
+	void Scene::SetAccelerationType(AccelerationType type)
+	{
+		//Switching type clears the structures, UpdateTransforms rebuilds the meshes that got cleared
+		m_TopLevelAccelerationStructure.SetType(type);
+		m_TopLevelDirty = true;
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_Plane(m_PlaneGeometries[index], ray))
+			if (!mesh.keepAccelerationType)
 			{
-				return true;
+				mesh.accelerationStructure.SetType(type);
 			}
 		}
-		/*for (size_t index = 0; index < m_Triangles.size(); index++)
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.UpdateTransforms();
+		}
+
+		UpdateTopLevelAccelerationStructure();
+	}
+
+	void Scene::SetMeshAccelerationType(TriangleMesh& mesh, AccelerationType type)
+	{
+		if (mesh.pInstanceSource)
+		{
+			return;
+		}
+
+		mesh.keepAccelerationType = true;
+		mesh.accelerationStructure.SetType(type);
+		mesh.UpdateTransforms();
+	}
+
+	void Scene::SwitchAccelerationType()
+	{
+		AccelerationType type{};
+		switch (m_TopLevelAccelerationStructure.GetType())
 		{
-			HitRecord tempHitRecord{};
-			if (GeometryUtils::HitTest_Triangle(m_Triangles[index], ray, tempHitRecord))
+		case AccelerationType::BVH:
+			type = AccelerationType::Grid;
+			break;
+		case AccelerationType::Grid:
+			type = AccelerationType::KdTree;
+			break;
+		case AccelerationType::KdTree:
+			type = AccelerationType::BVH;
+			break;
+		}
+
+		std::cout << "------------\nACCELERATION STRUCTURE: " << AccelerationStructure::GetTypeName(type) << "\n------------\n";
+		SetAccelerationType(type);
+		PrintAccelerationStats();
+	}
+
+	void Scene::BenchmarkAccelerationStructures(float aspectRatio)
+	{
+		//Primary and shadow rays of a low resolution frame, generated like Renderer::RenderTile
+		constexpr int width{ 160 };
+		const int height = std::max(1, static_cast<int>(width / aspectRatio));
+
+		m_Camera.CalculateCameraToWorld();
+		const float fov = tanf(m_Camera.fovAngle * TO_RADIANS / 2.f);
+
+		std::cout << "------------\nACCELERATION BENCHMARK: " << sceneName << '\n';
+
+		std::vector<Ray> viewRays{};
+		viewRays.reserve(static_cast<size_t>(width) * height);
+		for (int py = 0; py < height; ++py)
+		{
+			for (int px = 0; px < width; ++px)
 			{
-				return true;
+				const float cx = ((2 * (px + 0.5f)) / width - 1) * aspectRatio * fov;
+				const float cy = (1 - (2 * (py + 0.5f)) / height) * fov;
+
+				viewRays.push_back(Ray{ m_Camera.origin, m_Camera.cameraToWorld.TransformVector(Vector3{ cx, cy, 1 }.Normalized()) });
 			}
-		}*/
-		for (size_t index = 0; index < m_TriangleMeshGeometries.size(); index++)
+		}
+
+		//Traces the view rays and the shadow rays of their hits, collects the shadow rays when asked to
+		const auto traceFrame = [this, &viewRays](std::vector<Ray>* pShadowRays)
+			{
+				for (const Ray& viewRay : viewRays)
+				{
+					HitRecord closestHit{};
+					GetClosestHit(viewRay, closestHit);
+					if (!closestHit.didHit)
+					{
+						continue;
+					}
+
+					for (const Light& light : m_Lights)
+					{
+						Ray lightRay{};
+						lightRay.origin = closestHit.origin;
+						lightRay.direction = LightUtils::GetDirectionToLight(light, lightRay.origin + closestHit.normal * 0.01f);
+						lightRay.min = 0.1f;
+						lightRay.max = lightRay.direction.Magnitude();
+						lightRay.direction.Normalize();
+
+						DoesHit(lightRay);
+						if (pShadowRays)
+						{
+							pShadowRays->push_back(lightRay);
+						}
+					}
+				}
+			};
+
+		//Whole scene on one type first, so the meshes get timed below the fastest top level
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[index], ray))
+			mesh.keepAccelerationType = false;
+		}
+
+		AccelerationType fastestType{ AccelerationType::BVH };
+		float fastestTime{ FLT_MAX };
+
+		for (const AccelerationType type : { AccelerationType::BVH, AccelerationType::Grid, AccelerationType::KdTree })
+		{
+			const auto buildStart = std::chrono::high_resolution_clock::now();
+			SetAccelerationType(type);
+			const auto traceStart = std::chrono::high_resolution_clock::now();
+
+			traceFrame(nullptr);
+
+			const auto traceEnd = std::chrono::high_resolution_clock::now();
+			const float buildTime = std::chrono::duration<float, std::milli>(traceStart - buildStart).count();
+			const float traceTime = std::chrono::duration<float, std::milli>(traceEnd - traceStart).count();
+
+			std::cout << AccelerationStructure::GetTypeName(type) << ": build " << buildTime << "ms, trace " << traceTime << "ms\n";
+
+			if (traceTime < fastestTime)
 			{
-				return true;
+				fastestTime = traceTime;
+				fastestType = type;
 			}
 		}
 
-		return false;
+		std::cout << "Using " << AccelerationStructure::GetTypeName(fastestType) << '\n';
+		SetAccelerationType(fastestType);
+
+		//Then every mesh on its own, against the same view and shadow rays
+		std::vector<Ray> shadowRays{};
+		traceFrame(&shadowRays);
+
+		for (size_t index = 0; index < m_TriangleMeshGeometries.size(); ++index)
+		{
+			TriangleMesh& mesh = m_TriangleMeshGeometries[index];
+			if (mesh.pInstanceSource || mesh.accelerationStructure.IsEmpty())
+			{
+				continue;
+			}
+
+			AccelerationType fastestMeshType{ fastestType };
+			float fastestMeshTime{ FLT_MAX };
+
+			std::cout << "Mesh " << index << ':';
+			for (const AccelerationType type : { AccelerationType::BVH, AccelerationType::Grid, AccelerationType::KdTree })
+			{
+				SetMeshAccelerationType(mesh, type);
+				const auto traceStart = std::chrono::high_resolution_clock::now();
+
+				for (const Ray& viewRay : viewRays)
+				{
+					HitCandidate closest{};
+					GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::ClosestHit>(mesh, viewRay, closest);
+				}
+				for (const Ray& shadowRay : shadowRays)
+				{
+					GeometryUtils::NoHitRecord noHit{};
+					GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::AnyHit>(mesh, shadowRay, noHit);
+				}
+
+				const float traceTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - traceStart).count();
+				std::cout << ' ' << AccelerationStructure::GetTypeName(type) << ' ' << traceTime << "ms";
+
+				if (traceTime < fastestMeshTime)
+				{
+					fastestMeshTime = traceTime;
+					fastestMeshType = type;
+				}
+			}
+
+			std::cout << ", using " << AccelerationStructure::GetTypeName(fastestMeshType) << '\n';
+			SetMeshAccelerationType(mesh, fastestMeshType);
+		}
+
+		std::cout << "------------\n";
+		UpdateTopLevelAccelerationStructure();
 	}
 
 #pragma region Scene Helpers
@@ -127,6 +838,7 @@ namespace dae {
 		s.materialIndex = materialIndex;
 
 		m_SphereGeometries.emplace_back(s);
+		m_TopLevelDirty = true;
 		return &m_SphereGeometries.back();
 	}
 
@@ -138,6 +850,7 @@ namespace dae {
 		p.materialIndex = materialIndex;
 
 		m_PlaneGeometries.emplace_back(p);
+		m_TopLevelDirty = true;
 		return &m_PlaneGeometries.back();
 	}
 
@@ -148,9 +861,41 @@ namespace dae {
 		m.materialIndex = materialIndex;
 
 		m_TriangleMeshGeometries.emplace_back(m);
+		UpdateInstanceSources();
+		m_TopLevelDirty = true;
+		return &m_TriangleMeshGeometries.back();
+	}
+
+	TriangleMesh* Scene::AddTriangleMeshInstance(const TriangleMesh* pSourceMesh, unsigned char materialIndex)
+	{
+		assert(pSourceMesh);
+
+		//Instances of instances share the original source
+		TriangleMesh m{};
+		m.instanceSourceIndex = pSourceMesh->pInstanceSource ? pSourceMesh->instanceSourceIndex : static_cast<uint32_t>(pSourceMesh - m_TriangleMeshGeometries.data());
+		assert(m.instanceSourceIndex < m_TriangleMeshGeometries.size());
+
+		m.pInstanceSource = &m_TriangleMeshGeometries[m.instanceSourceIndex];
+		m.cullMode = pSourceMesh->cullMode;
+		m.materialIndex = materialIndex;
+
+		m_TriangleMeshGeometries.emplace_back(m);
+		UpdateInstanceSources();
+		m_TopLevelDirty = true;
 		return &m_TriangleMeshGeometries.back();
 	}
 
+	void Scene::UpdateInstanceSources()
+	{
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
+		{
+			if (mesh.pInstanceSource)
+			{
+				mesh.pInstanceSource = &m_TriangleMeshGeometries[mesh.instanceSourceIndex];
+			}
+		}
+	}
+
 	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
 	{
 		Light l;
@@ -352,6 +1097,7 @@ namespace dae {
 
 		pMesh = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
 		Utils::ParseOBJ("Resources/simple_cube.obj", pMesh->positions, pMesh->normals, pMesh->indices);
+		pMesh->OptimizeLayout();
 
 		pMesh->CalculateNormals();
 
@@ -415,18 +1161,17 @@ namespace dae {
 		m_Meshes[0]->UpdateAABB();
 		m_Meshes[0]->UpdateTransforms();
 
-		m_Meshes[1] = AddTriangleMesh(TriangleCullMode::FrontFaceCulling, matLambert_White);
-		m_Meshes[1]->AppendTriangle(baseTriangle, true);
+		//Same triangle again, only the cull mode and transform differ
+		m_Meshes[1] = AddTriangleMeshInstance(m_Meshes[0], matLambert_White);
+		m_Meshes[1]->cullMode = TriangleCullMode::FrontFaceCulling;
 		m_Meshes[1]->Translate({ 0.f, 1.5f, 0.f });
 
-		m_Meshes[1]->UpdateAABB();
 		m_Meshes[1]->UpdateTransforms();
 
-		m_Meshes[2] = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
-		m_Meshes[2]->AppendTriangle(baseTriangle, true);
+		m_Meshes[2] = AddTriangleMeshInstance(m_Meshes[0], matLambert_White);
+		m_Meshes[2]->cullMode = TriangleCullMode::NoCulling;
 		m_Meshes[2]->Translate({ 1.75f, 1.5f, 0.f });
 
-		m_Meshes[2]->UpdateAABB();
 		m_Meshes[2]->UpdateTransforms();
 
 		//Lights
@@ -474,6 +1219,7 @@ namespace dae {
 			pMesh->positions,
 			pMesh->normals,
 			pMesh->indices);
+		pMesh->OptimizeLayout();
 
 		pMesh->Scale({ 2.f, 2.f, 2.f });
 		pMesh->Translate({ 0.f, -1.5f, 0.f });
@@ -481,6 +1227,9 @@ namespace dae {
 		pMesh->UpdateAABB();
 		pMesh->UpdateTransforms();
 
+		//Frozen geometry, only the transform animates
+		pMesh->Compact();
+
 
 		//Light
 		AddPointLight(Vector3{ 0.f, 5.f, 5.f },		50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
@@ -517,8 +1266,10 @@ namespace dae {
 			m_Meshes[0]->positions,
 			m_Meshes[0]->normals,
 			m_Meshes[0]->indices);
+		m_Meshes[0]->OptimizeLayout();
 
 		m_Meshes[0]->Scale({ 8.f, 1.f, 10.f });
+		m_Meshes[0]->accelerationStructure.GetBVH().SetBuilder(BVHBuilder::SpatialSAH);
 		m_Meshes[0]->UpdateTransforms();
 
 
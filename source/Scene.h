@@ -35,7 +35,29 @@ namespace dae
 
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		//Closest hit of every ray of the packet, closestHits holds one record per ray
+		void GetClosestHit(const RayPacket& packet, HitRecord* closestHits) const;
 		bool DoesHit(const Ray& ray) const;
+		//Occlusion test of every active ray of the packet, returns the mask of the blocked rays
+		uint64_t DoesHit(const RayPacket& packet) const;
+
+		//Refits (or rebuilds when needed) the top-level acceleration structure over all bounded geometry (spheres and meshes)
+		//and repacks the plane blocks, skipped when no geometry got added and no mesh transform changed since the last update
+		void UpdateTopLevelAccelerationStructure();
+		//Build time and quality of every mesh acceleration structure
+		void PrintAccelerationStats() const;
+		//Cycles every BVH through the binary, wide and compressed node layouts, to compare their traversal speed
+		void SwitchBVHLayout();
+
+		//Uses the same acceleration structure type for the top level and every mesh without a type of its own, and builds them
+		void SetAccelerationType(AccelerationType type);
+		//Gives one mesh its own acceleration structure type, instances always use the structure of their source
+		void SetMeshAccelerationType(TriangleMesh& mesh, AccelerationType type);
+		//Cycles SetAccelerationType through BVH, grid and kd-tree
+		void SwitchAccelerationType();
+		//Traces a small frame from the current camera with every acceleration structure type and keeps the fastest,
+		//first for the whole scene, then for every mesh on its own
+		void BenchmarkAccelerationStructures(float aspectRatio);
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
@@ -51,6 +73,22 @@ namespace dae
 		std::vector<Light> m_Lights{};
 		std::vector<Material*> m_Materials{};
 
+		//Top-level acceleration structure, primitive i < m_TopLevelSphereCount is a sphere, the rest are meshes
+		//Planes are unbounded and stay in m_PlaneGeometries, every ray tests them through m_PlaneBlocks
+		AccelerationStructure m_TopLevelAccelerationStructure{};
+		uint32_t m_TopLevelSphereCount{};
+		//Set when geometry got added or the top level got cleared, moved meshes flag themselves through TriangleMesh::transformChanged
+		bool m_TopLevelDirty{ true };
+
+		//BVH top level only: the spheres of every leaf packed in blocks, the leaf whose primitives start at index first
+		//uses the blocks from m_SphereBlocks[m_LeafSphereBlockStarts[first]] on, and holds m_LeafMeshCounts[first] meshes next to its spheres
+		std::vector<SphereBlock> m_SphereBlocks{};
+		std::vector<uint32_t> m_LeafSphereBlockStarts{};
+		std::vector<uint32_t> m_LeafMeshCounts{};
+
+		//m_PlaneGeometries packed in blocks, refreshed with the top level
+		std::vector<PlaneBlock> m_PlaneBlocks{};
+
 		//Temp
 		//std::vector<Triangle> m_Triangles{};
 
@@ -59,10 +97,25 @@ namespace dae
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		//Places the geometry of pSourceMesh again with its own transform, without copying vertices or the BVH
+		TriangleMesh* AddTriangleMeshInstance(const TriangleMesh* pSourceMesh, unsigned char materialIndex = 0);
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
 		unsigned char AddMaterial(Material* pMaterial);
+
+	private:
+		void UpdateSphereBlocks();
+		void UpdatePlaneBlocks();
+		//Points every instance at its source mesh again, call after m_TriangleMeshGeometries grew
+		void UpdateInstanceSources();
+
+		//Steps of the single ray GetClosestHit, they only record closer hits than closest.t and lower nodeRay.max to it
+		void HitTest_Planes(const Ray& ray, HitCandidate& closest, bool& closestIsPlane) const;
+		bool HitTest_LeafSpheres(uint32_t first, uint32_t sphereCount, Ray& nodeRay, HitCandidate& closest, bool& closestIsPlane) const;
+		bool HitTest_Mesh(uint32_t primitiveIndex, Ray& nodeRay, HitCandidate& closest, bool& closestIsPlane) const;
+		//Builds the HitRecord of the final hit, for single rays and packets
+		void ResolveClosestHit(const Ray& ray, const HitCandidate& closest, bool closestIsPlane, HitRecord& closestHit) const;
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
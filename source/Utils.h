@@ -1,6 +1,8 @@
 #pragma once
 #include <cassert>
+#include <bit>
 #include <fstream>
+#include <type_traits>
 #include "Math.h"
 #include "DataTypes.h"
 
@@ -10,103 +12,314 @@ namespace dae
 {
 	namespace GeometryUtils
 	{
-#pragma region Sphere HitTest
-		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//What a hit test has to report, a template parameter so every kernel gets compiled once per query without runtime branches
+		enum class HitQuery
 		{
-			Vector3 d = ray.direction;
+			AnyHit,		//Occlusion, stops at any hit within the ray interval and never touches a HitRecord
+			ClosestHit,	//Only t (and the triangle of a mesh) goes into a HitCandidate, ResolveHit builds the HitRecord of the final hit
+			Attributes	//Full HitRecord
+		};
+
+		//AnyHit queries take this instead of a HitRecord
+		struct NoHitRecord {};
+
+		template<HitQuery Query>
+		using QueryRecord = std::conditional_t<Query == HitQuery::AnyHit, NoHitRecord, std::conditional_t<Query == HitQuery::ClosestHit, HitCandidate, HitRecord>>;
 
-			float A = Vector3::Dot(ray.direction, ray.direction);
-			float B = 2 * Vector3::Dot( d, (ray.origin - sphere.origin));
-			float C = Vector3::Dot((ray.origin - sphere.origin), (ray.origin - sphere.origin)) - powf(sphere.radius, 2.f);
+		/**
+		 * \brief Calls blockTest(uint32_t block, uint32_t laneMask) for every RayBlock of a packet with a ray in rayMask
+		 * \return the rays of rayMask whose lanes blockTest returned
+		 */
+		template<typename BlockTest>
+		inline uint64_t ForEachRayBlock(uint64_t rayMask, BlockTest&& blockTest)
+		{
+			constexpr uint64_t blockLanes{ (uint64_t{ 1 } << RayBlockWidth) - 1 };
 
-			float discriminat = powf(B, 2.f) - 4 * A * C;
-			if (discriminat <= 0)
+			uint64_t resultMask{ 0 };
+			for (uint32_t block = 0; block < RayPacketBlockCount; ++block)
 			{
-				return false;
+				const uint32_t shift = block * RayBlockWidth;
+				const uint32_t laneMask = static_cast<uint32_t>((rayMask >> shift) & blockLanes);
+				if (laneMask != 0)
+				{
+					resultMask |= uint64_t{ blockTest(block, laneMask) & laneMask } << shift;
+				}
 			}
-			if (discriminat < ray.min || discriminat > ray.max)
+			return resultMask;
+		}
+
+#pragma region Sphere HitTest
+		//SPHERE HIT-TESTS
+		//Attributes of a hit at distance t
+		inline void ResolveHit(const Sphere& sphere, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+		}
+
+		template<HitQuery Query>
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, QueryRecord<Query>& hitRecord)
+		{
+			//Half-b form of the quadratic, b = Dot(d, origin - center) instead of 2 * Dot(...)
+			const Vector3 centerToOrigin = ray.origin - sphere.origin;
+
+			const float A = Vector3::Dot(ray.direction, ray.direction);
+			const float b = Vector3::Dot(ray.direction, centerToOrigin);
+			const float C = Vector3::Dot(centerToOrigin, centerToOrigin) - sphere.radius * sphere.radius;
+
+			const float discriminant = b * b - A * C;
+			if (discriminant <= 0)
 			{
 				return false;
 			}
 
-
-			float sqrtD = sqrtf(discriminat);
-			float t = (-B - sqrtD) / (2 * A);
+			const float sqrtD = sqrtf(discriminant);
+			float t = (-b - sqrtD) / A;
 
 			if (t < ray.min)
 			{
-				t = (-B + sqrtD) / (2 * A);
+				t = (-b + sqrtD) / A;
 			}
 
-			////Geometric
-			//Vector3 L = sphere.origin - ray.origin;
-			//float tca = Vector3::Dot(L, ray.direction);
-			//float od = sqrt(Vector3::Dot(L, L) - tca * tca);
-			//float thc = sqrt(powf(sphere.radius, 2.f) - powf(od, 2.f));
-
-			//float t0 = tca - thc;
-			//float t1 = tca + thc;
-
-			Vector3 P = ray.origin + t * ray.direction;
-			Vector3 normal = (P - sphere.origin).Normalized();
-
 			if (t < ray.min || t > ray.max)
 			{
 				return false;
 			}
 
-			if (!ignoreHitRecord)
+			if constexpr (Query == HitQuery::ClosestHit)
 			{
-				hitRecord.didHit = true;
 				hitRecord.t = t;
-				hitRecord.materialIndex = sphere.materialIndex;
-				hitRecord.origin = P;
-				hitRecord.normal = normal;
+			}
+			else if constexpr (Query == HitQuery::Attributes)
+			{
+				ResolveHit(sphere, ray, t, hitRecord);
 			}
 			return true;
 		}
+
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_Sphere<HitQuery::Attributes>(sphere, ray, hitRecord);
+		}
+
+		//Occlusion test, only checks whether an intersection lies within [ray.min, ray.max]
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere(sphere, ray, temp, true);
+			NoHitRecord noHitRecord{};
+			return HitTest_Sphere<HitQuery::AnyHit>(sphere, ray, noHitRecord);
+		}
+
+		/**
+		 * \brief HitTest_Sphere against every sphere of a block at once
+		 * \param t receives the distance of every lane, the near root unless it lies before ray.min, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within [ray.min, ray.max]
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_SphereBlock(const SphereBlock& block, const Ray& ray, float* t)
+		{
+			const float A = Vector3::Dot(ray.direction, ray.direction);
+			using namespace SIMD;
+			const Lanes directionX = Set(ray.direction.x);
+			const Lanes directionY = Set(ray.direction.y);
+			const Lanes directionZ = Set(ray.direction.z);
+
+			const Lanes centerToOriginX = Sub(Set(ray.origin.x), Load(block.originX));
+			const Lanes centerToOriginY = Sub(Set(ray.origin.y), Load(block.originY));
+			const Lanes centerToOriginZ = Sub(Set(ray.origin.z), Load(block.originZ));
+
+			const Lanes b = Add(Add(Mul(directionX, centerToOriginX), Mul(directionY, centerToOriginY)), Mul(directionZ, centerToOriginZ));
+			const Lanes C = Sub(Add(Add(Mul(centerToOriginX, centerToOriginX), Mul(centerToOriginY, centerToOriginY)), Mul(centerToOriginZ, centerToOriginZ)), Load(block.radiusSquared));
+			const Lanes discriminant = Sub(Mul(b, b), Mul(Set(A), C));
+
+			//Most blocks miss entirely, skip the roots then
+			const Lanes zero = Zero();
+			Lanes hit = CmpGT(discriminant, zero);
+			if (MoveMask(hit) == 0)
+			{
+				return 0;
+			}
+
+			//Lanes that miss take the root of 0, they get masked out below
+			const Lanes sqrtD = Sqrt(Max(discriminant, zero));
+			const Lanes invA = Set(1.f / A);
+			const Lanes rayMin = Set(ray.min);
+
+			const Lanes nearT = Mul(Sub(Sub(zero, b), sqrtD), invA);
+			const Lanes farT = Mul(Add(Sub(zero, b), sqrtD), invA);
+			const Lanes hitT = Blend(nearT, farT, CmpLT(nearT, rayMin));
+
+			hit = And(hit, CmpGE(hitT, rayMin));
+			hit = And(hit, CmpLE(hitT, Set(ray.max)));
+
+			if constexpr (Query != HitQuery::AnyHit)
+			{
+				Store(t, hitT);
+			}
+			return MoveMask(hit);
+		}
+
+		/**
+		 * \brief HitTest_Sphere for every ray of a block against the same sphere
+		 * \param t receives the distance of every lane, the near root unless it lies before the min of the ray, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within their [min, max]
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_SphereRayBlock(const Sphere& sphere, const RayBlock& rays, float* t)
+		{
+			const float radiusSquared = sphere.radius * sphere.radius;
+			using namespace SIMD;
+			const Lanes directionX = Load(rays.directionX);
+			const Lanes directionY = Load(rays.directionY);
+			const Lanes directionZ = Load(rays.directionZ);
+
+			const Lanes centerToOriginX = Sub(Load(rays.originX), Set(sphere.origin.x));
+			const Lanes centerToOriginY = Sub(Load(rays.originY), Set(sphere.origin.y));
+			const Lanes centerToOriginZ = Sub(Load(rays.originZ), Set(sphere.origin.z));
+
+			const Lanes A = Add(Add(Mul(directionX, directionX), Mul(directionY, directionY)), Mul(directionZ, directionZ));
+			const Lanes b = Add(Add(Mul(directionX, centerToOriginX), Mul(directionY, centerToOriginY)), Mul(directionZ, centerToOriginZ));
+			const Lanes C = Sub(Add(Add(Mul(centerToOriginX, centerToOriginX), Mul(centerToOriginY, centerToOriginY)), Mul(centerToOriginZ, centerToOriginZ)), Set(radiusSquared));
+			const Lanes discriminant = Sub(Mul(b, b), Mul(A, C));
+
+			//Most rays of a packet miss a small sphere, skip the roots then
+			const Lanes zero = Zero();
+			Lanes hit = CmpGT(discriminant, zero);
+			if (MoveMask(hit) == 0)
+			{
+				return 0;
+			}
+
+			//Lanes that miss take the root of 0, they get masked out below
+			const Lanes sqrtD = Sqrt(Max(discriminant, zero));
+			const Lanes invA = Div(Set(1.f), A);
+			const Lanes rayMin = Load(rays.min);
+
+			const Lanes nearT = Mul(Sub(Sub(zero, b), sqrtD), invA);
+			const Lanes farT = Mul(Add(Sub(zero, b), sqrtD), invA);
+			const Lanes hitT = Blend(nearT, farT, CmpLT(nearT, rayMin));
+
+			hit = And(hit, CmpGE(hitT, rayMin));
+			hit = And(hit, CmpLE(hitT, Load(rays.max)));
+
+			if constexpr (Query != HitQuery::AnyHit)
+			{
+				Store(t, hitT);
+			}
+			return MoveMask(hit);
 		}
 
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Attributes of a hit at distance t
+		inline void ResolveHit(const Plane& plane, const Ray& ray, float t, HitRecord& hitRecord)
 		{
-			Vector3 n = plane.normal;
-			float dotOpOrN{ Vector3::Dot((plane.origin - ray.origin), n) };
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = plane.normal;
+		}
 
-			float t = dotOpOrN / Vector3::Dot(ray.direction, plane.normal);
+		template<HitQuery Query>
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, QueryRecord<Query>& hitRecord)
+		{
+			const float t = Vector3::Dot(plane.origin - ray.origin, plane.normal) / Vector3::Dot(ray.direction, plane.normal);
+			if (!(t > ray.min && t < ray.max))
+			{
+				return false;
+			}
 
-			Vector3 I = ray.origin + (dotOpOrN / Vector3::Dot(ray.direction, n)) * ray.direction;
-			if (t > ray.min && t < ray.max)
+			if constexpr (Query == HitQuery::ClosestHit)
 			{
-				if (!ignoreHitRecord)
-				{
-					hitRecord.didHit = true;
-					hitRecord.t = t;
-					hitRecord.materialIndex = plane.materialIndex;
-					hitRecord.origin = I;
-					hitRecord.normal = n;
-				}
-				return true;
+				hitRecord.t = t;
 			}
-			return false;
+			else if constexpr (Query == HitQuery::Attributes)
+			{
+				ResolveHit(plane, ray, t, hitRecord);
+			}
+			return true;
+		}
+
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_Plane<HitQuery::Attributes>(plane, ray, hitRecord);
 		}
 
+		//Occlusion test, only checks whether the intersection lies within (ray.min, ray.max)
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			NoHitRecord noHitRecord{};
+			return HitTest_Plane<HitQuery::AnyHit>(plane, ray, noHitRecord);
+		}
+
+		/**
+		 * \brief HitTest_Plane against every plane of a block at once
+		 * \param t receives the distance of every lane, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within (ray.min, ray.max)
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_PlaneBlock(const PlaneBlock& block, const Ray& ray, float* t)
+		{
+			using namespace SIMD;
+			const Lanes normalX = Load(block.normalX);
+			const Lanes normalY = Load(block.normalY);
+			const Lanes normalZ = Load(block.normalZ);
+
+			//t = Dot(origin - ray.origin, normal) / Dot(ray.direction, normal)
+			const Lanes toPlaneX = Sub(Load(block.originX), Set(ray.origin.x));
+			const Lanes toPlaneY = Sub(Load(block.originY), Set(ray.origin.y));
+			const Lanes toPlaneZ = Sub(Load(block.originZ), Set(ray.origin.z));
+			const Lanes distance = Add(Add(Mul(toPlaneX, normalX), Mul(toPlaneY, normalY)), Mul(toPlaneZ, normalZ));
+			const Lanes cosine = Add(Add(Mul(Set(ray.direction.x), normalX), Mul(Set(ray.direction.y), normalY)), Mul(Set(ray.direction.z), normalZ));
+			const Lanes hitT = Div(distance, cosine);
+
+			const Lanes hit = And(CmpGT(hitT, Set(ray.min)), CmpLT(hitT, Set(ray.max)));
+
+			if constexpr (Query != HitQuery::AnyHit)
+			{
+				Store(t, hitT);
+			}
+			return MoveMask(hit);
+		}
+
+		/**
+		 * \brief HitTest_Plane for every ray of a block against the same plane
+		 * \param t receives the distance of every lane, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within their (min, max)
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_PlaneRayBlock(const Plane& plane, const RayBlock& rays, float* t)
+		{
+			using namespace SIMD;
+			const Lanes normalX = Set(plane.normal.x);
+			const Lanes normalY = Set(plane.normal.y);
+			const Lanes normalZ = Set(plane.normal.z);
+
+			//t = Dot(origin - ray.origin, normal) / Dot(ray.direction, normal)
+			const Lanes toPlaneX = Sub(Set(plane.origin.x), Load(rays.originX));
+			const Lanes toPlaneY = Sub(Set(plane.origin.y), Load(rays.originY));
+			const Lanes toPlaneZ = Sub(Set(plane.origin.z), Load(rays.originZ));
+			const Lanes distance = Add(Add(Mul(toPlaneX, normalX), Mul(toPlaneY, normalY)), Mul(toPlaneZ, normalZ));
+			const Lanes cosine = Add(Add(Mul(Load(rays.directionX), normalX), Mul(Load(rays.directionY), normalY)), Mul(Load(rays.directionZ), normalZ));
+			const Lanes hitT = Div(distance, cosine);
+
+			const Lanes hit = And(CmpGT(hitT, Load(rays.min)), CmpLT(hitT, Load(rays.max)));
+
+			if constexpr (Query != HitQuery::AnyHit)
+			{
+				Store(t, hitT);
+			}
+			return MoveMask(hit);
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		template<HitQuery Query>
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, QueryRecord<Query>& hitRecord)
 		{
 			//Creating edges
 			Vector3 a = triangle.v1 - triangle.v0;
@@ -169,7 +382,11 @@ namespace dae
 				return false;
 			}
 
-			if (!ignoreHitRecord)
+			if constexpr (Query == HitQuery::ClosestHit)
+			{
+				hitRecord.t = t;
+			}
+			else if constexpr (Query == HitQuery::Attributes)
 			{
 				hitRecord.didHit = true;
 				hitRecord.t = t;
@@ -180,92 +397,1321 @@ namespace dae
 			return true;
 		}
 
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_Triangle<HitQuery::Attributes>(triangle, ray, hitRecord);
+		}
+
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			NoHitRecord noHitRecord{};
+			return HitTest_Triangle<HitQuery::AnyHit>(triangle, ray, noHitRecord);
+		}
+
+		/**
+		 * \brief Moller-Trumbore test against a precomputed triangle, the hit record is left to the caller
+		 * \param t distance to the hit, only written when the triangle is hit within [ray.min, ray.max]
+		 */
+		inline bool HitTest_TriangleRecord(const TriangleRecord& triangle, TriangleCullMode cullMode, const Ray& ray, float& t)
+		{
+			const Vector3 p = Vector3::Cross(ray.direction, triangle.edge2);
+
+			//determinant = -Dot(normal, ray.direction)
+			const float determinant = Vector3::Dot(triangle.edge1, p);
+			if (determinant == 0.f
+				|| (cullMode == TriangleCullMode::BackFaceCulling && determinant < 0.f)
+				|| (cullMode == TriangleCullMode::FrontFaceCulling && determinant > 0.f))
+			{
+				return false;
+			}
+			const float invDeterminant = 1.f / determinant;
+
+			const Vector3 s = ray.origin - triangle.v0;
+			const float u = Vector3::Dot(s, p) * invDeterminant;
+			if (u < 0.f || u > 1.f)
+			{
+				return false;
+			}
+
+			const Vector3 q = Vector3::Cross(s, triangle.edge1);
+			const float v = Vector3::Dot(ray.direction, q) * invDeterminant;
+			if (v < 0.f || u + v > 1.f)
+			{
+				return false;
+			}
+
+			const float hitT = Vector3::Dot(triangle.edge2, q) * invDeterminant;
+			if (hitT < ray.min || hitT > ray.max)
+			{
+				return false;
+			}
+
+			t = hitT;
+			return true;
+		}
+
+		//Shared Moller-Trumbore core of the triangle kernels, s = ray origin - v0
+		template<HitQuery Query>
+		inline uint32_t HitTest_TriangleLanes(SIMD::Lanes directionX, SIMD::Lanes directionY, SIMD::Lanes directionZ,
+			SIMD::Lanes edge1X, SIMD::Lanes edge1Y, SIMD::Lanes edge1Z, SIMD::Lanes edge2X, SIMD::Lanes edge2Y, SIMD::Lanes edge2Z,
+			SIMD::Lanes sX, SIMD::Lanes sY, SIMD::Lanes sZ, TriangleCullMode cullMode, SIMD::Lanes rayMin, SIMD::Lanes rayMax, float* t)
+		{
+			using namespace SIMD;
+
+			//p = Cross(direction, edge2), determinant = Dot(edge1, p)
+			const Lanes pX = Sub(Mul(directionY, edge2Z), Mul(directionZ, edge2Y));
+			const Lanes pY = Sub(Mul(directionZ, edge2X), Mul(directionX, edge2Z));
+			const Lanes pZ = Sub(Mul(directionX, edge2Y), Mul(directionY, edge2X));
+			const Lanes determinant = Add(Add(Mul(edge1X, pX), Mul(edge1Y, pY)), Mul(edge1Z, pZ));
+			const Lanes invDeterminant = Div(Set(1.f), determinant);
+			const Lanes u = Mul(Add(Add(Mul(sX, pX), Mul(sY, pY)), Mul(sZ, pZ)), invDeterminant);
+
+			//q = Cross(s, edge1)
+			const Lanes qX = Sub(Mul(sY, edge1Z), Mul(sZ, edge1Y));
+			const Lanes qY = Sub(Mul(sZ, edge1X), Mul(sX, edge1Z));
+			const Lanes qZ = Sub(Mul(sX, edge1Y), Mul(sY, edge1X));
+			const Lanes v = Mul(Add(Add(Mul(directionX, qX), Mul(directionY, qY)), Mul(directionZ, qZ)), invDeterminant);
+			const Lanes hitT = Mul(Add(Add(Mul(edge2X, qX), Mul(edge2Y, qY)), Mul(edge2Z, qZ)), invDeterminant);
+
+			const Lanes zero = Zero();
+			Lanes hit;
+			switch (cullMode)
+			{
+			case TriangleCullMode::BackFaceCulling:
+				hit = CmpGT(determinant, zero);
+				break;
+			case TriangleCullMode::FrontFaceCulling:
+				hit = CmpLT(determinant, zero);
+				break;
+			case TriangleCullMode::NoCulling:
+			default:
+				hit = CmpNEQ(determinant, zero);
+				break;
+			}
+
+			hit = And(hit, CmpGE(u, zero));
+			hit = And(hit, CmpGE(v, zero));
+			hit = And(hit, CmpLE(Add(u, v), Set(1.f)));
+			hit = And(hit, CmpGE(hitT, rayMin));
+			hit = And(hit, CmpLE(hitT, rayMax));
+
+			if constexpr (Query != HitQuery::AnyHit)
+			{
+				Store(t, hitT);
+			}
+			return MoveMask(hit);
+		}
+
+		/**
+		 * \brief HitTest_TriangleRecord against every triangle of a block at once
+		 * \param t receives the distance of every lane, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within [ray.min, ray.max]
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_TriangleBlock(const TriangleBlock& block, TriangleCullMode cullMode, const Ray& ray, float* t)
+		{
+			using namespace SIMD;
+			const Lanes directionX = Set(ray.direction.x);
+			const Lanes directionY = Set(ray.direction.y);
+			const Lanes directionZ = Set(ray.direction.z);
+
+			const Lanes edge1X = Load(block.edge1X);
+			const Lanes edge1Y = Load(block.edge1Y);
+			const Lanes edge1Z = Load(block.edge1Z);
+			const Lanes edge2X = Load(block.edge2X);
+			const Lanes edge2Y = Load(block.edge2Y);
+			const Lanes edge2Z = Load(block.edge2Z);
+
+			const Lanes sX = Sub(Set(ray.origin.x), Load(block.v0X));
+			const Lanes sY = Sub(Set(ray.origin.y), Load(block.v0Y));
+			const Lanes sZ = Sub(Set(ray.origin.z), Load(block.v0Z));
+
+			return HitTest_TriangleLanes<Query>(directionX, directionY, directionZ, edge1X, edge1Y, edge1Z, edge2X, edge2Y, edge2Z,
+				sX, sY, sZ, cullMode, Set(ray.min), Set(ray.max), t);
+		}
+
+		/**
+		 * \brief HitTest_TriangleRecord for every ray of a block against the same triangle
+		 * \param t receives the distance of every lane, untouched (may be nullptr) for AnyHit
+		 * \return bitmask of the lanes hit within their [min, max]
+		 */
+		template<HitQuery Query = HitQuery::ClosestHit>
+		inline uint32_t HitTest_TriangleRayBlock(const TriangleRecord& triangle, TriangleCullMode cullMode, const RayBlock& rays, float* t)
+		{
+			using namespace SIMD;
+			const Lanes directionX = Load(rays.directionX);
+			const Lanes directionY = Load(rays.directionY);
+			const Lanes directionZ = Load(rays.directionZ);
+
+			const Lanes edge1X = Set(triangle.edge1.x);
+			const Lanes edge1Y = Set(triangle.edge1.y);
+			const Lanes edge1Z = Set(triangle.edge1.z);
+			const Lanes edge2X = Set(triangle.edge2.x);
+			const Lanes edge2Y = Set(triangle.edge2.y);
+			const Lanes edge2Z = Set(triangle.edge2.z);
+
+			const Lanes sX = Sub(Load(rays.originX), Set(triangle.v0.x));
+			const Lanes sY = Sub(Load(rays.originY), Set(triangle.v0.y));
+			const Lanes sZ = Sub(Load(rays.originZ), Set(triangle.v0.z));
+
+			return HitTest_TriangleLanes<Query>(directionX, directionY, directionZ, edge1X, edge1Y, edge1Z, edge2X, edge2Y, edge2Z,
+				sX, sY, sZ, cullMode, Load(rays.min), Load(rays.max), t);
 		}
 #pragma endregion
-#pragma region TriangeMesh HitTest
-		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+#pragma region BVH HitTest
+		inline bool SlabTest_BVHNode(const BVHNode& node, const Ray& ray, const Vector3& invDirection, float& tEntry)
 		{
-			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
-			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
+			const float tx1 = (node.minAABB.x - ray.origin.x) * invDirection.x;
+			const float tx2 = (node.maxAABB.x - ray.origin.x) * invDirection.x;
 
 			float tmin = std::min(tx1, tx2);
 			float tmax = std::max(tx1, tx2);
 
-			float ty1 = (mesh.transformedMinAABB.y - ray.origin.y) / ray.direction.y;
-			float ty2 = (mesh.transformedMaxAABB.y - ray.origin.y) / ray.direction.y;
+			const float ty1 = (node.minAABB.y - ray.origin.y) * invDirection.y;
+			const float ty2 = (node.maxAABB.y - ray.origin.y) * invDirection.y;
 
 			tmin = std::max(tmin, std::min(ty1, ty2));
 			tmax = std::min(tmax, std::max(ty1, ty2));
 
-			float tz1 = (mesh.transformedMinAABB.z - ray.origin.z) / ray.direction.z;
-			float tz2 = (mesh.transformedMaxAABB.z - ray.origin.z) / ray.direction.z;
+			const float tz1 = (node.minAABB.z - ray.origin.z) * invDirection.z;
+			const float tz2 = (node.maxAABB.z - ray.origin.z) * invDirection.z;
 
 			tmin = std::max(tmin, std::min(tz1, tz2));
 			tmax = std::min(tmax, std::max(tz1, tz2));
 
-			return tmax > 0 && tmax >= tmin;
+			tEntry = tmin;
+			return tmax >= tmin && tmax > ray.min && tmin < ray.max;
+		}
+
+		//Shared tail of the wide slab tests, takes the slab distances of every child
+		inline uint32_t SlabTest_WideIntervals(SIMD::Lanes tx1, SIMD::Lanes tx2, SIMD::Lanes ty1, SIMD::Lanes ty2, SIMD::Lanes tz1, SIMD::Lanes tz2, const Ray& ray, float* tEntry)
+		{
+			using namespace SIMD;
+			const Lanes tmin = Max(Max(Min(tx1, tx2), Min(ty1, ty2)), Min(tz1, tz2));
+			const Lanes tmax = Min(Min(Max(tx1, tx2), Max(ty1, ty2)), Max(tz1, tz2));
+
+			const Lanes hit = And(And(
+				CmpGE(tmax, tmin),
+				CmpGT(tmax, Set(ray.min))),
+				CmpLT(tmin, Set(ray.max)));
+
+			Store(tEntry, tmin);
+			return MoveMask(hit);
+		}
+
+		/**
+		 * \brief Slab test of the ray against every child of a collapsed node at once
+		 * \param tEntry receives the entry distance of every child
+		 * \return bitmask of the children that got hit (empty lanes still need to be skipped by the caller)
+		 */
+		inline uint32_t SlabTest_BVHWideNode(const BVHWideNode& node, const Ray& ray, const Vector3& invDirection, float* tEntry)
+		{
+			using namespace SIMD;
+			const Lanes originX = Set(ray.origin.x);
+			const Lanes originY = Set(ray.origin.y);
+			const Lanes originZ = Set(ray.origin.z);
+			const Lanes invX = Set(invDirection.x);
+			const Lanes invY = Set(invDirection.y);
+			const Lanes invZ = Set(invDirection.z);
+
+			const Lanes tx1 = Mul(Sub(Load(node.minX), originX), invX);
+			const Lanes tx2 = Mul(Sub(Load(node.maxX), originX), invX);
+			const Lanes ty1 = Mul(Sub(Load(node.minY), originY), invY);
+			const Lanes ty2 = Mul(Sub(Load(node.maxY), originY), invY);
+			const Lanes tz1 = Mul(Sub(Load(node.minZ), originZ), invZ);
+			const Lanes tz2 = Mul(Sub(Load(node.maxZ), originZ), invZ);
+			return SlabTest_WideIntervals(tx1, tx2, ty1, ty2, tz1, tz2, ray, tEntry);
+		}
+
+		//2^exponent, built straight from the float bits
+		inline float QuantizationCellSize(int8_t exponent)
+		{
+			return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23);
+		}
+
+		/**
+		 * \brief Slab test against every child of a compressed node, the ray gets moved into the grid of the node
+		 * so every slab distance is a single multiply-add on the quantized bound
+		 */
+		inline uint32_t SlabTest_BVHWideNode(const BVHCompressedNode& node, const Ray& ray, const Vector3& invDirection, float* tEntry)
+		{
+			//t = (origin + q * cellSize - rayOrigin) * invDirection = q * scale + offset
+			const float scaleX = QuantizationCellSize(node.exponent[0]) * invDirection.x;
+			const float scaleY = QuantizationCellSize(node.exponent[1]) * invDirection.y;
+			const float scaleZ = QuantizationCellSize(node.exponent[2]) * invDirection.z;
+			const float offsetX = (node.origin.x - ray.origin.x) * invDirection.x;
+			const float offsetY = (node.origin.y - ray.origin.y) * invDirection.y;
+			const float offsetZ = (node.origin.z - ray.origin.z) * invDirection.z;
+
+			using namespace SIMD;
+			const Lanes tx1 = Add(Mul(Load(node.minX), Set(scaleX)), Set(offsetX));
+			const Lanes tx2 = Add(Mul(Load(node.maxX), Set(scaleX)), Set(offsetX));
+			const Lanes ty1 = Add(Mul(Load(node.minY), Set(scaleY)), Set(offsetY));
+			const Lanes ty2 = Add(Mul(Load(node.maxY), Set(scaleY)), Set(offsetY));
+			const Lanes tz1 = Add(Mul(Load(node.minZ), Set(scaleZ)), Set(offsetZ));
+			const Lanes tz2 = Add(Mul(Load(node.maxZ), Set(scaleZ)), Set(offsetZ));
+			return SlabTest_WideIntervals(tx1, tx2, ty1, ty2, tz1, tz2, ray, tEntry);
+		}
+
+		/**
+		 * \brief Runs the leaf test of the BVH traversals on one leaf, which takes one of two forms:
+		 * bool(uint32_t primitiveIndex, Ray& nodeRay) gets called for every primitive of the leaf,
+		 * bool(uint32_t first, uint32_t count, Ray& nodeRay) once with the range of the leaf in BVH::GetPrimitiveIndices (SIMD leaf tests)
+		 * \param anyHit stop at the first primitive that got hit
+		 */
+		template<typename LeafTest>
+		inline bool HitTest_BVHLeaf(const std::vector<uint32_t>& primitiveIndices, uint32_t first, uint32_t count, bool anyHit, Ray& nodeRay, LeafTest&& leafTest)
+		{
+			if constexpr (std::is_invocable_r_v<bool, LeafTest, uint32_t, uint32_t, Ray&>)
+			{
+				return leafTest(first, count, nodeRay);
+			}
+			else
+			{
+				bool didHit{ false };
+				for (uint32_t index = first; index < first + count; ++index)
+				{
+					if (leafTest(primitiveIndices[index], nodeRay))
+					{
+						if (anyHit)
+						{
+							return true;
+						}
+						didHit = true;
+					}
+				}
+				return didHit;
+			}
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Works on both BVHWideNode and BVHCompressedNode arrays
+		template<typename WideNode, typename LeafTest>
+		inline bool HitTest_WideBVH(const std::vector<WideNode>& nodes, const BVH& bvh, const Ray& ray, LeafTest&& leafTest)
 		{
-			if (!SlabTest_TriangleMesh(mesh, ray))
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+			if (nodes.empty())
 			{
 				return false;
 			}
 
-			HitRecord closestRecord{};
-			int normalIndex{};
-			Triangle tempTriangle{};
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			Ray nodeRay{ ray };
+			bool didHit{ false };
 
-			for (size_t index = 0; index < mesh.indices.size(); index += 3)
+			//Every level pushes at most BVHWideWidth - 1 more nodes than it pops
+			uint32_t stack[BVH::MaxDepth * (BVHWideWidth - 1) + 1];
+			uint32_t stackSize{ 0 };
+			stack[stackSize++] = 0;
+
+			float tEntry[BVHWideWidth];
+			uint32_t hitLanes[BVHWideWidth];
+
+			while (stackSize > 0)
 			{
-				if (index + 2 < mesh.indices.size())
+				const WideNode& node = nodes[stack[--stackSize]];
+
+				//Sort the hit children near to far
+				uint32_t hitMask = SlabTest_BVHWideNode(node, nodeRay, invDirection, tEntry);
+				uint32_t hitCount{ 0 };
+				while (hitMask)
 				{
-					uint32_t p0 = mesh.indices[index];
-					uint32_t p1 = mesh.indices[index + 1];
-					uint32_t p2 = mesh.indices[index + 2];
+					const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+					hitMask &= hitMask - 1;
 
+					if (node.child[lane] == BVHWideNode::InvalidChild)
+					{
+						continue;
+					}
 
-					tempTriangle =
+					uint32_t insert = hitCount++;
+					while (insert > 0 && tEntry[hitLanes[insert - 1]] > tEntry[lane])
 					{
-						mesh.transformedPositions[p0],
-						mesh.transformedPositions[p1],
-						mesh.transformedPositions[p2],
-						mesh.transformedNormals[normalIndex]
-					};
-					normalIndex++;
+						hitLanes[insert] = hitLanes[insert - 1];
+						--insert;
+					}
+					hitLanes[insert] = lane;
+				}
 
-					tempTriangle.cullMode = mesh.cullMode;
-					tempTriangle.materialIndex = mesh.materialIndex;
+				//Leaves are intersected right away so they can shrink the ray before the inner children get pushed
+				uint32_t innerLanes[BVHWideWidth];
+				uint32_t innerCount{ 0 };
+				for (uint32_t index = 0; index < hitCount; ++index)
+				{
+					const uint32_t lane = hitLanes[index];
+					if (tEntry[lane] >= nodeRay.max)
+					{
+						break;
+					}
 
-					if (GeometryUtils::HitTest_Triangle(tempTriangle, ray, closestRecord, ignoreHitRecord))
+					if (node.primitiveCount[lane] == 0)
 					{
-						if (ignoreHitRecord)
-						{
-							return true;
-						}
-						else
-						{
-							if (closestRecord.t < hitRecord.t)
-							{
-								hitRecord = closestRecord;
-							}
-						}
+						innerLanes[innerCount++] = lane;
+						continue;
+					}
+
+					didHit |= HitTest_BVHLeaf(primitiveIndices, node.child[lane], node.primitiveCount[lane], false, nodeRay, leafTest);
+				}
+
+				//Push far to near so the nearest child gets popped first
+				for (uint32_t index = innerCount; index-- > 0;)
+				{
+					if (tEntry[innerLanes[index]] < nodeRay.max)
+					{
+						stack[stackSize++] = node.child[innerLanes[index]];
 					}
 				}
 			}
 
-			return hitRecord.didHit;
+			return didHit;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		//Any-hit version of HitTest_WideBVH for occlusion queries: nothing gets sorted, the lanes are visited in stored (largest first) order
+		template<typename WideNode, typename LeafTest>
+		inline bool OcclusionTest_WideBVH(const std::vector<WideNode>& nodes, const BVH& bvh, const Ray& ray, LeafTest&& leafTest)
+		{
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			Ray nodeRay{ ray };
+
+			uint32_t stack[BVH::MaxDepth * (BVHWideWidth - 1) + 1];
+			uint32_t stackSize{ 0 };
+			stack[stackSize++] = 0;
+
+			float tEntry[BVHWideWidth];
+
+			while (stackSize > 0)
+			{
+				const WideNode& node = nodes[stack[--stackSize]];
+
+				//Leaves first, any of them can end the query before the inner children get pushed
+				uint32_t hitMask = SlabTest_BVHWideNode(node, nodeRay, invDirection, tEntry);
+				uint32_t innerMask{ 0 };
+				while (hitMask)
+				{
+					const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+					hitMask &= hitMask - 1;
+
+					if (node.child[lane] == BVHWideNode::InvalidChild)
+					{
+						continue;
+					}
+
+					if (node.primitiveCount[lane] == 0)
+					{
+						innerMask |= 1u << lane;
+						continue;
+					}
+
+					if (HitTest_BVHLeaf(primitiveIndices, node.child[lane], node.primitiveCount[lane], true, nodeRay, leafTest))
+					{
+						return true;
+					}
+				}
+
+				//Push the last lane first so the largest child gets popped first
+				while (innerMask)
+				{
+					const uint32_t lane = 31 - static_cast<uint32_t>(std::countl_zero(innerMask));
+					innerMask &= ~(1u << lane);
+					stack[stackSize++] = node.child[lane];
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * \brief Walks a BVH front-to-back and calls leafTest for every leaf the ray reaches
+		 * \param leafTest per primitive or per leaf, see HitTest_BVHLeaf. Should lower nodeRay.max when it records a closer hit
+		 * \return true if leafTest reported at least one hit
+		 */
+		template<typename LeafTest>
+		inline bool HitTest_BVH(const BVH& bvh, const Ray& ray, LeafTest&& leafTest)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			switch (bvh.GetLayout())
+			{
+			case BVHLayout::Wide:
+				return HitTest_WideBVH(bvh.GetWideNodes(), bvh, ray, leafTest);
+			case BVHLayout::Compressed:
+				return HitTest_WideBVH(bvh.GetCompressedNodes(), bvh, ray, leafTest);
+			default:
+				break;
+			}
+
+			const std::vector<BVHNode>& nodes = bvh.GetNodes();
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			//Shrinks to the closest hit so far, so farther nodes get culled
+			Ray nodeRay{ ray };
+			bool didHit{ false };
+
+			uint32_t stack[BVH::MaxDepth];
+			uint32_t stackSize{ 0 };
+
+			float tEntry{};
+			if (!SlabTest_BVHNode(nodes[0], nodeRay, invDirection, tEntry))
+			{
+				return false;
+			}
+			stack[stackSize++] = 0;
+
+			while (stackSize > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackSize]];
+
+				if (node.IsLeaf())
+				{
+					didHit |= HitTest_BVHLeaf(primitiveIndices, node.leftFirst, node.primitiveCount, false, nodeRay, leafTest);
+					continue;
+				}
+
+				//Visit the nearest child first, push it last
+				const uint32_t leftIndex = node.leftFirst;
+				float tLeft{}, tRight{};
+				const bool hitLeft = SlabTest_BVHNode(nodes[leftIndex], nodeRay, invDirection, tLeft);
+				const bool hitRight = SlabTest_BVHNode(nodes[leftIndex + 1], nodeRay, invDirection, tRight);
+
+				if (hitLeft && hitRight)
+				{
+					if (tLeft < tRight)
+					{
+						stack[stackSize++] = leftIndex + 1;
+						stack[stackSize++] = leftIndex;
+					}
+					else
+					{
+						stack[stackSize++] = leftIndex;
+						stack[stackSize++] = leftIndex + 1;
+					}
+				}
+				else if (hitLeft)
+				{
+					stack[stackSize++] = leftIndex;
+				}
+				else if (hitRight)
+				{
+					stack[stackSize++] = leftIndex + 1;
+				}
+			}
+
+			return didHit;
+		}
+
+		/**
+		 * \brief Any-hit walk for shadow rays, stops at the first primitive leafTest reports as hit
+		 * Children are visited in stored order (the larger sibling first), which finds an occluder sooner than sorting by distance
+		 * \param leafTest per primitive or per leaf (see HitTest_BVHLeaf), true when the primitive blocks the ray
+		 */
+		template<typename LeafTest>
+		inline bool OcclusionTest_BVH(const BVH& bvh, const Ray& ray, LeafTest&& leafTest)
+		{
+			switch (bvh.GetLayout())
+			{
+			case BVHLayout::Wide:
+				return OcclusionTest_WideBVH(bvh.GetWideNodes(), bvh, ray, leafTest);
+			case BVHLayout::Compressed:
+				return OcclusionTest_WideBVH(bvh.GetCompressedNodes(), bvh, ray, leafTest);
+			default:
+				break;
+			}
+
+			const std::vector<BVHNode>& nodes = bvh.GetNodes();
+			const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			Ray nodeRay{ ray };
+
+			uint32_t stack[BVH::MaxDepth];
+			uint32_t stackSize{ 0 };
+			stack[stackSize++] = 0;
+
+			float tEntry{};
+			while (stackSize > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackSize]];
+
+				if (!SlabTest_BVHNode(node, nodeRay, invDirection, tEntry))
+				{
+					continue;
+				}
+
+				if (node.IsLeaf())
+				{
+					if (HitTest_BVHLeaf(primitiveIndices, node.leftFirst, node.primitiveCount, true, nodeRay, leafTest))
+					{
+						return true;
+					}
+					continue;
+				}
+
+				stack[stackSize++] = node.leftFirst + 1;
+				stack[stackSize++] = node.leftFirst;
+			}
+
+			return false;
+		}
+
+		//SlabTest_BVHNode for every ray of a block against the same box, returns the bitmask of the lanes that reach it
+		inline uint32_t SlabTest_RayBlock(const Vector3& minAABB, const Vector3& maxAABB, const RayBlock& rays)
+		{
+			//min and max operands swapped so ties and NaNs resolve like std::min and std::max in SlabTest_BVHNode
+			using namespace SIMD;
+			const Lanes invDirectionX = Load(rays.invDirectionX);
+			const Lanes invDirectionY = Load(rays.invDirectionY);
+			const Lanes invDirectionZ = Load(rays.invDirectionZ);
+			const Lanes originX = Load(rays.originX);
+			const Lanes originY = Load(rays.originY);
+			const Lanes originZ = Load(rays.originZ);
+
+			const Lanes tx1 = Mul(Sub(Set(minAABB.x), originX), invDirectionX);
+			const Lanes tx2 = Mul(Sub(Set(maxAABB.x), originX), invDirectionX);
+
+			Lanes tmin = Min(tx2, tx1);
+			Lanes tmax = Max(tx2, tx1);
+
+			const Lanes ty1 = Mul(Sub(Set(minAABB.y), originY), invDirectionY);
+			const Lanes ty2 = Mul(Sub(Set(maxAABB.y), originY), invDirectionY);
+
+			tmin = Max(Min(ty2, ty1), tmin);
+			tmax = Min(Max(ty2, ty1), tmax);
+
+			const Lanes tz1 = Mul(Sub(Set(minAABB.z), originZ), invDirectionZ);
+			const Lanes tz2 = Mul(Sub(Set(maxAABB.z), originZ), invDirectionZ);
+
+			tmin = Max(Min(tz2, tz1), tmin);
+			tmax = Min(Max(tz2, tz1), tmax);
+
+			Lanes hit = CmpGE(tmax, tmin);
+			hit = And(hit, CmpGT(tmax, Load(rays.min)));
+			hit = And(hit, CmpLT(tmin, Load(rays.max)));
+			return MoveMask(hit);
+		}
+
+		//Bounds of one child of a collapsed node
+		inline void GetChildBounds(const BVHWideNode& node, uint32_t lane, Vector3& minAABB, Vector3& maxAABB)
+		{
+			minAABB = Vector3{ node.minX[lane], node.minY[lane], node.minZ[lane] };
+			maxAABB = Vector3{ node.maxX[lane], node.maxY[lane], node.maxZ[lane] };
+		}
+
+		inline void GetChildBounds(const BVHCompressedNode& node, uint32_t lane, Vector3& minAABB, Vector3& maxAABB)
+		{
+			const Vector3 cellSize{ QuantizationCellSize(node.exponent[0]), QuantizationCellSize(node.exponent[1]), QuantizationCellSize(node.exponent[2]) };
+			minAABB = Vector3{ node.origin.x + node.minX[lane] * cellSize.x, node.origin.y + node.minY[lane] * cellSize.y, node.origin.z + node.minZ[lane] * cellSize.z };
+			maxAABB = Vector3{ node.origin.x + node.maxX[lane] * cellSize.x, node.origin.y + node.maxY[lane] * cellSize.y, node.origin.z + node.maxZ[lane] * cellSize.z };
+		}
+
+		//SlabTest_RayBlock of every block with a ray in rayMask, returns the rays of rayMask that reach the box
+		inline uint64_t SlabTest_RayPacket(const Vector3& minAABB, const Vector3& maxAABB, const RayBlock* rayBlocks, uint64_t rayMask)
+		{
+			return ForEachRayBlock(rayMask, [&](uint32_t block, uint32_t)
+				{
+					return SlabTest_RayBlock(minAABB, maxAABB, rayBlocks[block]);
+				});
+		}
+
+		//Direction of the first ray in rayMask, orders the children of a node for the whole packet
+		inline Vector3 GetFirstRayDirection(const RayBlock* rayBlocks, uint64_t rayMask)
+		{
+			const uint32_t firstRay = static_cast<uint32_t>(std::countr_zero(rayMask));
+			const RayBlock& firstBlock = rayBlocks[firstRay / RayBlockWidth];
+			const uint32_t lane = firstRay % RayBlockWidth;
+			return Vector3{ firstBlock.directionX[lane], firstBlock.directionY[lane], firstBlock.directionZ[lane] };
+		}
+
+		/**
+		 * \brief Packet version of HitTest_WideBVH, works on both BVHWideNode and BVHCompressedNode arrays.
+		 * Every child is frustum culled and slab tested once per ray block, leaves are intersected right away
+		 * in near to far order along the first ray, inner children get pushed with the mask of the rays that reach them
+		 */
+		template<typename WideNode, typename LeafTest>
+		inline void HitTest_WideBVHPacket(const std::vector<WideNode>& nodes, const RayFrustum& frustum, RayBlock* rayBlocks, uint64_t activeMask, LeafTest&& leafTest)
+		{
+			if (nodes.empty())
+			{
+				return;
+			}
+
+			struct StackEntry
+			{
+				uint32_t node;
+				uint64_t rayMask;
+			};
+			StackEntry stack[BVH::MaxDepth * (BVHWideWidth - 1) + 1];
+			uint32_t stackSize{ 0 };
+			stack[stackSize++] = { 0, activeMask };
+
+			while (stackSize > 0 && activeMask != 0)
+			{
+				const StackEntry entry = stack[--stackSize];
+				const WideNode& node = nodes[entry.node];
+
+				const uint64_t rayMask = entry.rayMask & activeMask;
+				if (rayMask == 0)
+				{
+					continue;
+				}
+
+				//Sort the reached children near to far along the first ray
+				const Vector3 direction = GetFirstRayDirection(rayBlocks, rayMask);
+				uint64_t childMasks[BVHWideWidth];
+				float childDistance[BVHWideWidth];
+				uint32_t hitLanes[BVHWideWidth];
+				uint32_t hitCount{ 0 };
+				for (uint32_t lane = 0; lane < BVHWideWidth; ++lane)
+				{
+					if (node.child[lane] == BVHWideNode::InvalidChild)
+					{
+						continue;
+					}
+
+					Vector3 minAABB{}, maxAABB{};
+					GetChildBounds(node, lane, minAABB, maxAABB);
+					if (frustum.IsOutside(minAABB, maxAABB))
+					{
+						continue;
+					}
+
+					childMasks[lane] = SlabTest_RayPacket(minAABB, maxAABB, rayBlocks, rayMask);
+					if (childMasks[lane] == 0)
+					{
+						continue;
+					}
+
+					childDistance[lane] = Vector3::Dot(minAABB + maxAABB, direction);
+					uint32_t insert = hitCount++;
+					while (insert > 0 && childDistance[hitLanes[insert - 1]] > childDistance[lane])
+					{
+						hitLanes[insert] = hitLanes[insert - 1];
+						--insert;
+					}
+					hitLanes[insert] = lane;
+				}
+
+				uint32_t innerLanes[BVHWideWidth];
+				uint32_t innerCount{ 0 };
+				for (uint32_t index = 0; index < hitCount; ++index)
+				{
+					const uint32_t lane = hitLanes[index];
+					if (node.primitiveCount[lane] == 0)
+					{
+						innerLanes[innerCount++] = lane;
+						continue;
+					}
+
+					const uint64_t leafMask = childMasks[lane] & activeMask;
+					if (leafMask != 0)
+					{
+						activeMask &= ~leafTest(node.child[lane], static_cast<uint32_t>(node.primitiveCount[lane]), leafMask);
+					}
+				}
+
+				//Push far to near so the nearest child gets popped first
+				for (uint32_t index = innerCount; index-- > 0;)
+				{
+					stack[stackSize++] = { node.child[innerLanes[index]], childMasks[innerLanes[index]] };
+				}
+			}
+		}
+
+		/**
+		 * \brief Walks a BVH once for a packet of rays in its current layout, slab testing RayBlockWidth rays at a time.
+		 * Every node carries the mask of the rays that reached its parent, nodes outside the frustum are skipped for all of them at once
+		 * \param rayBlocks the rays of the packet, leafTest should lower their max when it records a closer hit
+		 * \param activeMask rays to trace, bit i is lane i % RayBlockWidth of block i / RayBlockWidth
+		 * \param leafTest uint64_t(first, count, leafMask) with leafMask the rays that reached the leaf,
+		 * returns the rays that are done (e.g. found occluded), they are dropped from the rest of the walk
+		 */
+		template<typename LeafTest>
+		inline void HitTest_BVHPacket(const BVH& bvh, const RayFrustum& frustum, RayBlock* rayBlocks, uint64_t activeMask, LeafTest&& leafTest)
+		{
+			switch (bvh.GetLayout())
+			{
+			case BVHLayout::Wide:
+				return HitTest_WideBVHPacket(bvh.GetWideNodes(), frustum, rayBlocks, activeMask, leafTest);
+			case BVHLayout::Compressed:
+				return HitTest_WideBVHPacket(bvh.GetCompressedNodes(), frustum, rayBlocks, activeMask, leafTest);
+			default:
+				break;
+			}
+
+			const std::vector<BVHNode>& nodes = bvh.GetNodes();
+			if (nodes.empty())
+			{
+				return;
+			}
+
+			struct StackEntry
+			{
+				uint32_t node;
+				uint64_t rayMask;
+			};
+			StackEntry stack[BVH::MaxDepth];
+			uint32_t stackSize{ 0 };
+			stack[stackSize++] = { 0, activeMask };
+
+			while (stackSize > 0 && activeMask != 0)
+			{
+				const StackEntry entry = stack[--stackSize];
+				const BVHNode& node = nodes[entry.node];
+
+				const uint64_t rayMask = entry.rayMask & activeMask;
+				if (rayMask == 0 || frustum.IsOutside(node.minAABB, node.maxAABB))
+				{
+					continue;
+				}
+
+				const uint64_t hitMask = SlabTest_RayPacket(node.minAABB, node.maxAABB, rayBlocks, rayMask);
+				if (hitMask == 0)
+				{
+					continue;
+				}
+
+				if (node.IsLeaf())
+				{
+					activeMask &= ~leafTest(node.leftFirst, node.primitiveCount, hitMask);
+					continue;
+				}
+
+				//Both children go on the stack, the one nearer along the first ray is pushed last so it gets visited first
+				const Vector3 direction = GetFirstRayDirection(rayBlocks, hitMask);
+
+				const uint32_t leftIndex = node.leftFirst;
+				const BVHNode& left = nodes[leftIndex];
+				const BVHNode& right = nodes[leftIndex + 1];
+				const bool leftFirst = Vector3::Dot(left.minAABB + left.maxAABB, direction) < Vector3::Dot(right.minAABB + right.maxAABB, direction);
+
+				stack[stackSize++] = { leftFirst ? leftIndex + 1 : leftIndex, hitMask };
+				stack[stackSize++] = { leftFirst ? leftIndex : leftIndex + 1, hitMask };
+			}
+		}
+#pragma endregion
+#pragma region Grid And KdTree HitTest
+		//Entry and exit distance of the ray through an AABB, clamped to [ray.min, ray.max]
+		inline bool SlabTest_AABB(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray, const Vector3& invDirection, float& tEntry, float& tExit)
+		{
+			tEntry = ray.min;
+			tExit = ray.max;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float t1 = (minAABB[axis] - ray.origin[axis]) * invDirection[axis];
+				const float t2 = (maxAABB[axis] - ray.origin[axis]) * invDirection[axis];
+
+				//Parallel rays inside the slab give NaN here, std::max/std::min keep the current bounds then
+				tEntry = std::max(tEntry, std::min(t1, t2));
+				tExit = std::min(tExit, std::max(t1, t2));
+			}
+
+			return tEntry <= tExit;
+		}
+
+		//Remembers the last tested primitives, grid cells and kd-tree leaves share primitives that span several of them
+		struct PrimitiveMailbox
+		{
+			static constexpr uint32_t Size{ 8 };
+			uint32_t primitives[Size]{ 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+
+			//False when the primitive was already tested
+			bool Insert(uint32_t primitive)
+			{
+				uint32_t& slot = primitives[primitive & (Size - 1)];
+				if (slot == primitive)
+				{
+					return false;
+				}
+				slot = primitive;
+				return true;
+			}
+		};
+
+		/**
+		 * \brief Walks the grid cells along the ray with a 3D-DDA, same contract as HitTest_BVH
+		 */
+		template<typename LeafTest>
+		inline bool HitTest_Grid(const Grid& grid, const Ray& ray, bool anyHit, LeafTest&& leafTest)
+		{
+			if (grid.IsEmpty())
+			{
+				return false;
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			float tEntry{}, tExit{};
+			if (!SlabTest_AABB(grid.GetMinAABB(), grid.GetMaxAABB(), ray, invDirection, tEntry, tExit))
+			{
+				return false;
+			}
+
+			const int* resolution = grid.GetResolution();
+			const Vector3& minAABB = grid.GetMinAABB();
+			const Vector3& cellSize = grid.GetCellSize();
+			const Vector3 entryPoint = ray.origin + ray.direction * tEntry;
+
+			int cell[3]{}, step[3]{};
+			float tNext[3]{}, tDelta[3]{};
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				cell[axis] = std::clamp(static_cast<int>((entryPoint[axis] - minAABB[axis]) * grid.GetInvCellSize()[axis]), 0, resolution[axis] - 1);
+
+				//Flat axes and axes the ray runs parallel to never get stepped
+				if (ray.direction[axis] == 0.f || resolution[axis] == 1)
+				{
+					step[axis] = 0;
+					tNext[axis] = FLT_MAX;
+					tDelta[axis] = FLT_MAX;
+					continue;
+				}
+
+				step[axis] = ray.direction[axis] > 0.f ? 1 : -1;
+				const float boundary = minAABB[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize[axis];
+				tNext[axis] = (boundary - ray.origin[axis]) * invDirection[axis];
+				tDelta[axis] = cellSize[axis] * std::abs(invDirection[axis]);
+			}
+
+			const std::vector<uint32_t>& cellStarts = grid.GetCellStarts();
+			const std::vector<uint32_t>& cellPrimitives = grid.GetCellPrimitives();
+
+			Ray nodeRay{ ray };
+			bool didHit{ false };
+			PrimitiveMailbox mailbox{};
+
+			while (true)
+			{
+				const size_t cellIndex = (static_cast<size_t>(cell[2]) * resolution[1] + cell[1]) * resolution[0] + cell[0];
+				for (uint32_t index = cellStarts[cellIndex]; index < cellStarts[cellIndex + 1]; ++index)
+				{
+					const uint32_t primitive = cellPrimitives[index];
+					if (mailbox.Insert(primitive) && leafTest(primitive, nodeRay))
+					{
+						if (anyHit)
+						{
+							return true;
+						}
+						didHit = true;
+					}
+				}
+
+				//Step over the nearest cell boundary, stop once the closest hit lies before it
+				const int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+				if (tNext[axis] >= nodeRay.max || tNext[axis] > tExit)
+				{
+					break;
+				}
+
+				cell[axis] += step[axis];
+				if (cell[axis] < 0 || cell[axis] >= resolution[axis])
+				{
+					break;
+				}
+				tNext[axis] += tDelta[axis];
+			}
+
+			return didHit;
+		}
+
+		/**
+		 * \brief Walks the kd-tree leaves front-to-back, same contract as HitTest_BVH
+		 */
+		template<typename LeafTest>
+		inline bool HitTest_KdTree(const KdTree& tree, const Ray& ray, bool anyHit, LeafTest&& leafTest)
+		{
+			const std::vector<KdNode>& nodes = tree.GetNodes();
+			const std::vector<uint32_t>& primitiveIndices = tree.GetPrimitiveIndices();
+
+			if (nodes.empty())
+			{
+				return false;
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			float tNear{}, tFar{};
+			if (!SlabTest_AABB(tree.GetMinAABB(), tree.GetMaxAABB(), ray, invDirection, tNear, tFar))
+			{
+				return false;
+			}
+
+			struct StackEntry
+			{
+				uint32_t node;
+				float tNear;
+				float tFar;
+			};
+
+			//Every inner node pushes at most one child
+			StackEntry stack[KdTree::MaxDepth + 1];
+			uint32_t stackSize{ 0 };
+
+			Ray nodeRay{ ray };
+			bool didHit{ false };
+			PrimitiveMailbox mailbox{};
+
+			uint32_t nodeIndex{ 0 };
+			while (true)
+			{
+				const KdNode& node = nodes[nodeIndex];
+
+				if (!node.IsLeaf())
+				{
+					const uint32_t axis = node.axis;
+					const float tSplit = (node.split - ray.origin[axis]) * invDirection[axis];
+
+					//The child on the side of the ray origin is visited first
+					const bool belowFirst = ray.origin[axis] < node.split || (ray.origin[axis] == node.split && ray.direction[axis] <= 0.f);
+					const uint32_t firstChild = belowFirst ? node.leftFirst : node.leftFirst + 1;
+					const uint32_t secondChild = belowFirst ? node.leftFirst + 1 : node.leftFirst;
+
+					if (ray.direction[axis] == 0.f || tSplit > tFar || tSplit <= 0.f)
+					{
+						nodeIndex = firstChild;
+					}
+					else if (tSplit < tNear)
+					{
+						nodeIndex = secondChild;
+					}
+					else
+					{
+						stack[stackSize++] = { secondChild, tSplit, tFar };
+						nodeIndex = firstChild;
+						tFar = tSplit;
+					}
+					continue;
+				}
+
+				for (uint32_t index = node.leftFirst; index < node.leftFirst + node.primitiveCount; ++index)
+				{
+					const uint32_t primitive = primitiveIndices[index];
+					if (mailbox.Insert(primitive) && leafTest(primitive, nodeRay))
+					{
+						if (anyHit)
+						{
+							return true;
+						}
+						didHit = true;
+					}
+				}
+
+				//A hit inside this leaf is closer than anything in the leaves still on the stack
+				if (nodeRay.max <= tFar)
+				{
+					break;
+				}
+
+				if (stackSize == 0)
+				{
+					break;
+				}
+				const StackEntry& entry = stack[--stackSize];
+				nodeIndex = entry.node;
+				tNear = entry.tNear;
+				tFar = entry.tFar;
+
+				if (tNear > nodeRay.max)
+				{
+					break;
+				}
+			}
+
+			return didHit;
+		}
+
+		//Dispatches to the traversal of the selected acceleration structure type, same contract as HitTest_BVH
+		template<typename LeafTest>
+		inline bool HitTest_AccelerationStructure(const AccelerationStructure& accelerationStructure, const Ray& ray, LeafTest&& leafTest)
+		{
+			switch (accelerationStructure.GetType())
+			{
+			case AccelerationType::Grid:
+				return HitTest_Grid(accelerationStructure.GetGrid(), ray, false, leafTest);
+			case AccelerationType::KdTree:
+				return HitTest_KdTree(accelerationStructure.GetKdTree(), ray, false, leafTest);
+			default:
+				return HitTest_BVH(accelerationStructure.GetBVH(), ray, leafTest);
+			}
+		}
+
+		//Occlusion query, same contract as OcclusionTest_BVH
+		//Grids and kd-trees already walk front-to-back without sorting, they just stop at the first hit
+		template<typename LeafTest>
+		inline bool OcclusionTest_AccelerationStructure(const AccelerationStructure& accelerationStructure, const Ray& ray, LeafTest&& leafTest)
+		{
+			switch (accelerationStructure.GetType())
+			{
+			case AccelerationType::Grid:
+				return HitTest_Grid(accelerationStructure.GetGrid(), ray, true, leafTest);
+			case AccelerationType::KdTree:
+				return HitTest_KdTree(accelerationStructure.GetKdTree(), ray, true, leafTest);
+			default:
+				return OcclusionTest_BVH(accelerationStructure.GetBVH(), ray, leafTest);
+			}
+		}
+#pragma endregion
+#pragma region TriangeMesh HitTest
+		//Attributes of a hit on triangle triangleIndex at distance t
+		inline void ResolveHit(const TriangleMesh& mesh, uint32_t triangleIndex, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			//Back to world space, normals transform with the inverse transpose: n' = (n.invX, n.invY, n.invZ)
+			const Vector3 objectNormal = mesh.GetGeometry().GetTriangleNormal(triangleIndex);
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.materialIndex = mesh.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = Vector3{
+				Vector3::Dot(objectNormal, mesh.inverseWorldTransform.GetAxisX()),
+				Vector3::Dot(objectNormal, mesh.inverseWorldTransform.GetAxisY()),
+				Vector3::Dot(objectNormal, mesh.inverseWorldTransform.GetAxisZ())
+			}.Normalized();
+		}
+
+		/**
+		 * \brief Tests the ray in object space against the triangles of the mesh
+		 * AnyHit stops at the first triangle in [ray.min, ray.max], the closest-hit queries walk the whole structure
+		 * and only keep triangles closer than hitRecord.t
+		 * \return whether a closer triangle was found
+		 */
+		template<HitQuery Query>
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, QueryRecord<Query>& hitRecord)
+		{
+			const TriangleMesh& geometry = mesh.GetGeometry();
+
+			//Object space ray, the direction is not normalized so t stays the same in both spaces
+			Ray objectRay{ ray };
+			objectRay.origin = mesh.inverseWorldTransform.TransformPoint(ray.origin);
+			objectRay.direction = mesh.inverseWorldTransform.TransformVector(ray.direction);
+
+			if constexpr (Query == HitQuery::AnyHit)
+			{
+				//BVH leaves test their triangle blocks at once
+				if (geometry.accelerationStructure.GetType() == AccelerationType::BVH)
+				{
+					return OcclusionTest_BVH(geometry.accelerationStructure.GetBVH(), objectRay, [&](uint32_t first, uint32_t count, Ray& nodeRay)
+						{
+							return geometry.ForEachLeafBlock(first, count, [&](const TriangleBlock& block)
+								{
+									return HitTest_TriangleBlock<HitQuery::AnyHit>(block, mesh.GetObjectCullMode(), nodeRay, nullptr) != 0;
+								});
+						});
+				}
+
+				return OcclusionTest_AccelerationStructure(geometry.accelerationStructure, objectRay, [&](uint32_t triangleIndex, Ray& nodeRay)
+					{
+						float t{};
+						return HitTest_TriangleRecord(geometry.GetTriangleRecord(triangleIndex), mesh.GetObjectCullMode(), nodeRay, t);
+					});
+			}
+			else
+			{
+				//Only the distance is tracked while walking, the hit record is filled once for the closest triangle
+				uint32_t closestTriangle{};
+				bool foundCloser{ false };
+
+				if (geometry.accelerationStructure.GetType() == AccelerationType::BVH)
+				{
+					//BVH leaves test their triangle blocks at once
+					HitTest_BVH(geometry.accelerationStructure.GetBVH(), objectRay, [&](uint32_t first, uint32_t count, Ray& nodeRay)
+						{
+							float t[TriangleBlockWidth];
+							bool foundInLeaf{ false };
+
+							geometry.ForEachLeafBlock(first, count, [&](const TriangleBlock& block)
+								{
+									uint32_t hitMask = HitTest_TriangleBlock(block, mesh.GetObjectCullMode(), nodeRay, t);
+									while (hitMask)
+									{
+										const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+										hitMask &= hitMask - 1;
+
+										if (t[lane] < hitRecord.t)
+										{
+											hitRecord.t = t[lane];
+											nodeRay.max = t[lane];
+											closestTriangle = block.triangle[lane];
+											foundInLeaf = true;
+										}
+									}
+									return false;
+								});
+
+							foundCloser |= foundInLeaf;
+							return foundInLeaf;
+						});
+				}
+				else
+				{
+					HitTest_AccelerationStructure(geometry.accelerationStructure, objectRay, [&](uint32_t triangleIndex, Ray& nodeRay)
+						{
+							float t{};
+							if (!HitTest_TriangleRecord(geometry.GetTriangleRecord(triangleIndex), mesh.GetObjectCullMode(), nodeRay, t) || t >= hitRecord.t)
+							{
+								return false;
+							}
+
+							hitRecord.t = t;
+							nodeRay.max = t;
+							closestTriangle = triangleIndex;
+							foundCloser = true;
+							return true;
+						});
+				}
+
+				if (foundCloser)
+				{
+					if constexpr (Query == HitQuery::ClosestHit)
+					{
+						hitRecord.triangleIndex = closestTriangle;
+					}
+					else
+					{
+						ResolveHit(mesh, closestTriangle, ray, hitRecord.t, hitRecord);
+					}
+				}
+
+				return foundCloser;
+			}
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_TriangleMesh<HitQuery::Attributes>(mesh, ray, hitRecord);
+		}
+
+		//Occlusion test, stops at the first triangle in [ray.min, ray.max] and never builds a hit record
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		{
+			NoHitRecord noHitRecord{};
+			return HitTest_TriangleMesh<HitQuery::AnyHit>(mesh, ray, noHitRecord);
+		}
+
+		/**
+		 * \brief HitTest_TriangleMesh for the rays of activeMask at once, the mesh BVH is walked a single time in object space.
+		 * AnyHit returns the rays that hit any triangle in [ray.min, ray.max], ClosestHit the rays that found a triangle
+		 * closer than closest[ray].t, which then holds its distance and index
+		 * \param frustum of the world space rays, moved to object space here
+		 * \param closest one per ray, untouched (may be nullptr) for AnyHit
+		 */
+		template<HitQuery Query>
+		inline uint64_t HitTest_TriangleMeshPacket(const TriangleMesh& mesh, const RayFrustum& frustum, const Ray* rays, uint64_t activeMask, HitCandidate* closest)
+		{
+			static_assert(Query != HitQuery::Attributes, "Packets resolve their hit records afterwards");
+
+			const TriangleMesh& geometry = mesh.GetGeometry();
+			uint64_t resultMask{ 0 };
+
+			//Only the BVH has a packet traversal, the rest goes ray by ray
+			if (geometry.accelerationStructure.GetType() != AccelerationType::BVH)
+			{
+				for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+				{
+					const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+
+					bool didHit{};
+					if constexpr (Query == HitQuery::AnyHit)
+					{
+						didHit = HitTest_TriangleMesh(mesh, rays[ray]);
+					}
+					else
+					{
+						didHit = HitTest_TriangleMesh<Query>(mesh, rays[ray], closest[ray]);
+					}
+
+					if (didHit)
+					{
+						resultMask |= uint64_t{ 1 } << ray;
+					}
+				}
+				return resultMask;
+			}
+
+			//Object space rays, the direction is not normalized so t stays the same in both spaces
+			RayBlock objectRays[RayPacketBlockCount];
+			for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+			{
+				const uint32_t ray = static_cast<uint32_t>(std::countr_zero(mask));
+
+				Ray objectRay{ rays[ray] };
+				objectRay.origin = mesh.inverseWorldTransform.TransformPoint(rays[ray].origin);
+				objectRay.direction = mesh.inverseWorldTransform.TransformVector(rays[ray].direction);
+				objectRays[ray / RayBlockWidth].SetLane(ray % RayBlockWidth, objectRay);
+			}
+
+			constexpr uint64_t blockLanes{ (uint64_t{ 1 } << RayBlockWidth) - 1 };
+			const std::vector<uint32_t>& primitiveIndices = geometry.accelerationStructure.GetBVH().GetPrimitiveIndices();
+
+			HitTest_BVHPacket(geometry.accelerationStructure.GetBVH(), frustum.Transformed(mesh.inverseWorldTransform, mesh.worldTransform), objectRays, activeMask,
+				[&](uint32_t first, uint32_t count, uint64_t leafMask)
+				{
+					uint64_t occludedMask{ 0 };
+					float t[RayBlockWidth];
+
+					for (uint32_t index = first; index < first + count && leafMask != 0; ++index)
+					{
+						const uint32_t triangleIndex = primitiveIndices[index];
+						const TriangleRecord triangle = geometry.GetTriangleRecord(triangleIndex);
+
+						for (uint32_t block = 0; block < RayPacketBlockCount; ++block)
+						{
+							const uint32_t shift = block * RayBlockWidth;
+							const uint32_t laneMask = static_cast<uint32_t>((leafMask >> shift) & blockLanes);
+							if (laneMask == 0)
+							{
+								continue;
+							}
+
+							uint32_t hitMask = HitTest_TriangleRayBlock<Query>(triangle, mesh.GetObjectCullMode(), objectRays[block], t) & laneMask;
+							if constexpr (Query == HitQuery::AnyHit)
+							{
+								occludedMask |= uint64_t{ hitMask } << shift;
+								leafMask &= ~(uint64_t{ hitMask } << shift);
+							}
+							else
+							{
+								while (hitMask)
+								{
+									const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+									hitMask &= hitMask - 1;
+
+									const uint32_t ray = shift + lane;
+									if (t[lane] < closest[ray].t)
+									{
+										closest[ray].t = t[lane];
+										closest[ray].triangleIndex = triangleIndex;
+										objectRays[block].max[lane] = t[lane];
+										resultMask |= uint64_t{ 1 } << ray;
+									}
+								}
+							}
+						}
+					}
+
+					resultMask |= occludedMask;
+					return occludedMask;
+				});
+
+			return resultMask;
 		}
 #pragma endregion
 	}
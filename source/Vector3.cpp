@@ -11,6 +11,8 @@ namespace dae {
 	const Vector3 Vector3::UnitZ = Vector3{ 0, 0, 1 };
 	const Vector3 Vector3::Zero = Vector3{ 0, 0, 0 };
 
+	//Scalar backend, MathSIMD.h defines these inline when DAE_SIMD_MATH is set
+#if !defined(DAE_SIMD_MATH)
 	Vector3::Vector3(float _x, float _y, float _z) : x(_x), y(_y), z(_z){}
 
 	Vector3::Vector3(const Vector4& v) : x(v.x), y(v.y), z(v.z){}
@@ -64,6 +66,8 @@ namespace dae {
 		return { Vector3{i, j, k} };
 	}
 
+#endif
+
 	Vector3 Vector3::Project(const Vector3& v1, const Vector3& v2)
 	{
 		return (v2 * (Dot(v1, v2) / Dot(v2, v2)));
@@ -79,6 +83,7 @@ namespace dae {
 		return v1 - (2.f * Vector3::Dot(v1, v2) * v2);
 	}
 
+#if !defined(DAE_SIMD_MATH)
 	Vector3 Vector3::Max(const Vector3& v1, const Vector3& v2)
 	{
 		return{
@@ -97,6 +102,8 @@ namespace dae {
 		};
 	}
 
+#endif
+
 	Vector4 Vector3::ToPoint4() const
 	{
 		return { x, y, z, 1 };
@@ -107,6 +114,7 @@ namespace dae {
 		return { x, y, z, 0 };
 	}
 
+#if !defined(DAE_SIMD_MATH)
 #pragma region Operator Overloads
 	Vector3 Vector3::operator*(float scale) const
 	{
@@ -183,4 +191,5 @@ namespace dae {
 		return z;
 	}
 #pragma endregion
+#endif
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+//Define DAE_SIMD_MATH (the Release configuration does) to use the header-only SSE backend of MathSIMD.h
+//instead of the scalar definitions in Vector3.cpp, Vector4.cpp and Matrix.cpp
+
 namespace dae
 {
 	struct Vector4;
@@ -59,3 +62,7 @@ namespace dae
 		return { v.x * scale, v.y * scale, v.z * scale };
 	}
 }
+
+#if defined(DAE_SIMD_MATH)
+#include "MathSIMD.h"
+#endif
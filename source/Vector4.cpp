@@ -7,6 +7,8 @@
 
 namespace dae
 {
+	//Scalar backend, MathSIMD.h defines these inline when DAE_SIMD_MATH is set
+#if !defined(DAE_SIMD_MATH)
 	Vector4::Vector4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
 	Vector4::Vector4(const Vector3& v, float _w) : x(v.x), y(v.y), z(v.z), w(_w) {}
 
@@ -91,4 +93,5 @@ namespace dae
 		return w;
 	}
 #pragma endregion
+#endif
 }
\ No newline at end of file
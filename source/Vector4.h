@@ -3,7 +3,8 @@
 namespace dae
 {
 	struct Vector3;
-	struct Vector4
+	//16 byte aligned so the SIMD backend loads it in one go
+	struct alignas(16) Vector4
 	{
 		float x;
 		float y;
@@ -30,3 +31,7 @@ namespace dae
 		float operator[](int index) const;
 	};
 }
+
+#if defined(DAE_SIMD_MATH)
+#include "MathSIMD.h"
+#endif
@@ -41,6 +41,11 @@ int main(int argc, char* args[])
 	if (!pWindow)
 		return 1;
 
+#if defined(DAE_SIMD_MATH)
+	//The SSE math has to give the same results as the scalar backend, the first operation that differs gets printed
+	SIMD::MatchesScalarBackend();
+#endif
+
 	//Initialize "framework"
 	const auto pTimer		= new Timer();
 	const auto pRenderer	= new Renderer(pWindow);
@@ -56,6 +61,8 @@ int main(int argc, char* args[])
 
 
 	pScene->Initialize();
+	pScene->BenchmarkAccelerationStructures(width / static_cast<float>(height));
+	pScene->PrintAccelerationStats();
 
 	//Start loop
 	pTimer->Start();
@@ -86,10 +93,22 @@ int main(int argc, char* args[])
 				{
 					pRenderer->ModeSwitcher();
 				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+				{
+					pScene->SwitchBVHLayout();
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5)
+				{
+					pScene->SwitchAccelerationType();
+				}
 				if (e.key.keysym.scancode == SDL_SCANCODE_F6)
 				{
 					pTimer->StartBenchmark();
 				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F7)
+				{
+					pRenderer->SwitchWavefront();
+				}
 				break;
 			}
 		}
@@ -107,6 +126,7 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			pRenderer->PrintWavefrontStats();
 		}
 
 		//Save screenshot after full render